@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "entry.h"
+#include "timestamp.h"
+#include "util.h"
+#include "view.h"
+
+/*
+ * Benchmarks of the paths every entry takes, from the journal to a reply.
+ * Each one runs REPETITIONS times and the fastest run is reported, which
+ * is the one least disturbed by the rest of the system. Allocations are
+ * counted by wrapping glibc's malloc, in libsystemd and libvarlink as well.
+ */
+
+#define REPETITIONS 5
+
+/* the service's default of entries per reply */
+#define BATCH_SIZE 500
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n_members, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+static unsigned long n_allocations;
+
+/* exported despite -fvisibility=hidden, so the libraries' calls land here too */
+_public_ void *malloc(size_t size) {
+        n_allocations += 1;
+
+        return __libc_malloc(size);
+}
+
+_public_ void *calloc(size_t n_members, size_t size) {
+        n_allocations += 1;
+
+        return __libc_calloc(n_members, size);
+}
+
+_public_ void *realloc(void *pointer, size_t size) {
+        n_allocations += 1;
+
+        return __libc_realloc(pointer, size);
+}
+
+typedef struct {
+        uint64_t nsec;
+        unsigned long n_allocations;
+        unsigned long n_items;
+
+        uint64_t start_nsec;
+        unsigned long start_allocations;
+} Run;
+
+static uint64_t now_nsec(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run_start(Run *run) {
+        run->start_allocations = n_allocations;
+        run->start_nsec = now_nsec();
+}
+
+static void run_stop(Run *run, unsigned long n_items) {
+        run->nsec += now_nsec() - run->start_nsec;
+        run->n_allocations += n_allocations - run->start_allocations;
+        run->n_items += n_items;
+}
+
+/* keeps results the compiler would otherwise throw away */
+static volatile unsigned long sink;
+
+static long open_journal(const char *path, sd_journal **journalp) {
+        const char *paths[] = { path, NULL };
+
+        return sd_journal_open_files(journalp, paths, 0);
+}
+
+static void sd_journal_closep(sd_journal **journalp) {
+        if (*journalp)
+                sd_journal_close(*journalp);
+}
+
+/* Formats a million timestamps about a millisecond apart. */
+static long bench_format_time(const char *path, Run *run) {
+        TimeFormat format;
+        uint64_t usec = 1500000000000000;
+        unsigned long n_items = 1000000;
+
+        time_format_init(&format, TIME_PRECISION_MICROSECONDS);
+
+        run_start(run);
+        for (unsigned long i = 0; i < n_items; i += 1) {
+                char time[40];
+
+                if (format_time_rfc3339(&format, usec, time, sizeof(time)) < 0)
+                        return -EINVAL;
+
+                sink += time[0];
+                usec += 997;
+        }
+        run_stop(run, n_items);
+
+        return 0;
+}
+
+/*
+ * Gets the fields that every entry is read with. Moving through the journal
+ * is timed on its own and taken off.
+ */
+static long bench_journal_get(const char *path, Run *run) {
+        _cleanup_(sd_journal_closep) sd_journal *journal = NULL;
+        unsigned long n_items = 0;
+        Run next = {};
+        long r;
+
+        r = open_journal(path, &journal);
+        if (r < 0)
+                return r;
+
+        run_start(&next);
+        while ((r = sd_journal_next(journal)) > 0)
+                n_items += 1;
+        run_stop(&next, n_items);
+        if (r < 0)
+                return r;
+
+        sd_journal_seek_head(journal);
+
+        run_start(run);
+        while ((r = sd_journal_next(journal)) > 0) {
+                const char *value;
+                unsigned long length;
+                uint64_t number;
+
+                if (journal_get_value(journal, "MESSAGE", &value, &length) >= 0)
+                        sink += length;
+
+                if (journal_get_value(journal, "SYSLOG_IDENTIFIER", &value, &length) >= 0)
+                        sink += length;
+
+                if (journal_get_unsigned(journal, "PRIORITY", &number) >= 0)
+                        sink += number;
+
+                if (journal_get_unsigned(journal, "_PID", &number) >= 0)
+                        sink += number;
+        }
+        run_stop(run, n_items);
+        if (r < 0)
+                return r;
+
+        run->nsec -= MIN(next.nsec, run->nsec);
+        run->n_allocations -= MIN(next.n_allocations, run->n_allocations);
+
+        return 0;
+}
+
+/* Reads and frees all entries with the fields monitors get by default. */
+static long bench_read_next_entry(const char *path, Run *run) {
+        _cleanup_(sd_journal_closep) sd_journal *journal = NULL;
+        EntryFields fields = {
+                .mask = ENTRY_FIELDS_DEFAULT,
+                .max_message_bytes = 64 * 1024
+        };
+        unsigned long n_items = 0;
+        long r;
+
+        r = open_journal(path, &journal);
+        if (r < 0)
+                return r;
+
+        journal_set_data_threshold(journal, &fields, NULL);
+
+        run_start(run);
+        for (;;) {
+                Entry *entry;
+
+                r = journal_read_next_entry(journal, &fields, NULL, &entry);
+                if (r <= 0)
+                        break;
+
+                sink += entry->size;
+                entry_unref(entry);
+                n_items += 1;
+        }
+        run_stop(run, n_items);
+
+        return r;
+}
+
+/*
+ * Turns all entries into replies of BATCH_SIZE entries and serializes them,
+ * like a monitor that receives every entry does.
+ */
+static long bench_serialize(const char *path, Run *run) {
+        _cleanup_(sd_journal_closep) sd_journal *journal = NULL;
+        EntryFields fields = {
+                .mask = ENTRY_FIELDS_DEFAULT,
+                .max_message_bytes = 64 * 1024
+        };
+        ViewOptions options = {
+                .fields = fields,
+                .time_precision = TIME_PRECISION_SECONDS,
+                .invalid_utf8 = INVALID_UTF8_REPLACE
+        };
+        View *views = NULL;
+        _cleanup_(view_unrefp) View *view = NULL;
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        long r;
+
+        r = open_journal(path, &journal);
+        if (r < 0)
+                return r;
+
+        journal_set_data_threshold(journal, &fields, NULL);
+
+        for (;;) {
+                Entry *entry;
+
+                r = journal_read_next_entry(journal, &fields, NULL, &entry);
+                if (r < 0) {
+                        entry_array_free(entries, n_entries);
+                        return r;
+                }
+
+                if (r == 0)
+                        break;
+
+                if (n_entries % 1024 == 0)
+                        entries = realloc(entries, (n_entries + 1024) * sizeof(Entry *));
+
+                entries[n_entries] = entry;
+                n_entries += 1;
+        }
+
+        r = view_get(&views, &options, &view);
+        if (r < 0) {
+                entry_array_free(entries, n_entries);
+                return r;
+        }
+
+        run_start(run);
+        for (unsigned long i = 0; i < n_entries; i += BATCH_SIZE) {
+                _cleanup_(varlink_object_unrefp) VarlinkObject *reply = NULL;
+                _cleanup_(freep) char *json = NULL;
+
+                varlink_object_new(&reply);
+                varlink_object_set_array(reply,
+                                         "entries",
+                                         view_get_entries_array(view, entries + i, MIN(BATCH_SIZE, n_entries - i)));
+
+                r = varlink_object_to_json(reply, &json);
+                if (r < 0)
+                        break;
+
+                sink += strlen(json);
+        }
+        run_stop(run, n_entries);
+
+        entry_array_free(entries, n_entries);
+
+        return r < 0 ? r : 0;
+}
+
+static const struct {
+        const char *name;
+        long (*run)(const char *path, Run *run);
+        bool needs_journal;
+} benchmarks[] = {
+        { "format_time",        bench_format_time,     false },
+        { "journal_get",        bench_journal_get,     true },
+        { "read_next_entry",    bench_read_next_entry, true },
+        { "serialize",          bench_serialize,       true }
+};
+
+int main(int argc, char **argv) {
+        const char *name = argc > 1 ? argv[1] : NULL;
+        const char *path = argc > 2 ? argv[2] : NULL;
+
+        for (unsigned long i = 0; i < ARRAY_SIZE(benchmarks); i += 1) {
+                Run best = {};
+
+                if (name && strcmp(name, benchmarks[i].name) != 0)
+                        continue;
+
+                if (benchmarks[i].needs_journal && !path) {
+                        fprintf(stderr, "%s: missing journal file\n", benchmarks[i].name);
+                        return EXIT_FAILURE;
+                }
+
+                for (unsigned long k = 0; k < REPETITIONS; k += 1) {
+                        Run run = {};
+                        long r;
+
+                        r = benchmarks[i].run(path, &run);
+                        if (r < 0) {
+                                fprintf(stderr, "%s: %s\n", benchmarks[i].name, strerror(-r));
+                                return EXIT_FAILURE;
+                        }
+
+                        if (k == 0 || run.nsec < best.nsec)
+                                best = run;
+                }
+
+                if (best.n_items == 0) {
+                        fprintf(stderr, "%s: nothing to measure\n", benchmarks[i].name);
+                        return EXIT_FAILURE;
+                }
+
+                printf("%-16s %12.0f entries/s %10.1f ns/entry %8.2f allocations/entry\n",
+                       benchmarks[i].name,
+                       best.n_items * 1e9 / MAX(best.nsec, 1),
+                       (double)best.nsec / best.n_items,
+                       (double)best.n_allocations / best.n_items);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#!/usr/bin/python3
+
+# Writes N synthetic journal entries in the journal export format, always
+# the same ones, for systemd-journal-remote to turn into a journal file.
+
+import random
+import struct
+import sys
+
+n_entries = int(sys.argv[1])
+path_out = sys.argv[2]
+
+boot_id = '0123456789abcdef0123456789abcdef'
+machine_id = 'fedcba9876543210fedcba9876543210'
+units = ['sshd.service', 'NetworkManager.service', 'systemd-logind.service', 'crond.service', 'kernel']
+words = ['connection', 'from', 'port', 'closed', 'accepted', 'failed', 'session', 'user', 'device',
+         'link', 'state', 'changed', 'starting', 'started', 'stopped', 'timeout', 'retrying', 'ok']
+
+def write_field(output, name, value):
+    if not isinstance(value, bytes):
+        value = str(value).encode()
+
+    # values that are not plain text are written with their length
+    if b'\n' in value or any(b >= 0x80 for b in value):
+        output.write(name.encode() + b'\n' + struct.pack('<Q', len(value)) + value + b'\n')
+    else:
+        output.write(name.encode() + b'=' + value + b'\n')
+
+random.seed(1)
+realtime = 1500000000000000
+monotonic = 1000000
+
+with open(path_out, 'wb') as output:
+    for i in range(n_entries):
+        unit = random.choice(units)
+        identifier = unit.split('.')[0]
+        message = ' '.join(random.choice(words) for _ in range(random.randint(3, 30)))
+
+        # some messages are long, a few are not valid UTF-8
+        if i % 100 == 0:
+            message = ' '.join([message] * 20)
+        message = message.encode()
+        if i % 1000 == 0:
+            message += b' \xff\xfe'
+
+        realtime += random.randint(1, 2000)
+        monotonic += random.randint(1, 2000)
+
+        write_field(output, '__REALTIME_TIMESTAMP', realtime)
+        write_field(output, '__MONOTONIC_TIMESTAMP', monotonic)
+        write_field(output, '_BOOT_ID', boot_id)
+        write_field(output, '_MACHINE_ID', machine_id)
+        write_field(output, '_HOSTNAME', 'bench')
+        write_field(output, '_TRANSPORT', 'syslog')
+        write_field(output, 'PRIORITY', random.randint(0, 7))
+        write_field(output, 'SYSLOG_IDENTIFIER', identifier)
+        write_field(output, '_COMM', identifier)
+        write_field(output, '_PID', random.randint(1, 65535))
+        write_field(output, '_UID', random.choice([0, 0, 0, 81, 1000]))
+        write_field(output, '_SYSTEMD_UNIT', unit)
+        write_field(output, 'MESSAGE', message)
+        output.write(b'\n')
@@ -0,0 +1,549 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "entry.h"
+#include "probes.h"
+#include "stats.h"
+#include "utf8.h"
+#include "util.h"
+
+/* offsets of the strings in the entry's allocation */
+struct EntryValue {
+        unsigned long name;
+
+        /* 0 if the entry does not have the field */
+        unsigned long value;
+        unsigned long value_length;
+};
+
+struct EntryObject {
+        EntryObject *next;
+        unsigned long view_id;
+        VarlinkObject *object;
+};
+
+/* Returns the value of @field, which points into the journal's mapping. */
+long journal_get_value(sd_journal *journal, const char *field, const char **valuep, unsigned long *lengthp) {
+        const void *data;
+        unsigned long field_length;
+        unsigned long length;
+        uint64_t start = profile_begin();
+        long r;
+
+        r = sd_journal_get_data(journal, field, &data, &length);
+        stats_profile(PROFILE_GET_DATA, start);
+        if (r < 0)
+                return r;
+
+        field_length = strlen(field) + 1; /* include the '=' */
+
+        if (length < field_length)
+                return -EBADMSG;
+
+        *valuep = (const char *)data + field_length;
+        *lengthp = length - field_length;
+
+        return 0;
+}
+
+/*
+ * Parses a decimal field like PRIORITY or _PID right in the journal's data,
+ * which is not NUL-terminated.
+ */
+long journal_get_unsigned(sd_journal *journal, const char *field, uint64_t *numberp) {
+        const char *value;
+        unsigned long length;
+        uint64_t number = 0;
+        long r;
+
+        r = journal_get_value(journal, field, &value, &length);
+        if (r < 0)
+                return r;
+
+        /* at most 19 digits do not overflow */
+        if (length == 0 || length > 19)
+                return -EINVAL;
+
+        for (unsigned long i = 0; i < length; i += 1) {
+                if (value[i] < '0' || value[i] > '9')
+                        return -EINVAL;
+
+                number = number * 10 + (value[i] - '0');
+        }
+
+        *numberp = number;
+
+        return 0;
+}
+
+/* Returns 1 if the message of the current entry matches @grep. */
+long journal_test_message(sd_journal *journal, const Grep *grep) {
+        const char *message;
+        unsigned long length;
+        long r;
+
+        r = journal_get_value(journal, "MESSAGE", &message, &length);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+
+        return grep_match(grep, message, length);
+}
+
+/*
+ * Lets the journal decompress only as much of large fields as @fields
+ * needs. It needs one byte more to tell whether a message was cut. The
+ * patterns of @grep are searched for in the whole message.
+ */
+void journal_set_data_threshold(sd_journal *journal, const EntryFields *fields, const Grep *grep) {
+        unsigned long threshold = 0;
+
+        if (!grep && fields->max_message_bytes > 0)
+                threshold = strlen("MESSAGE=") + fields->max_message_bytes + 1;
+
+        sd_journal_set_data_threshold(journal, threshold);
+}
+
+/*
+ * Journal field names consist of upper case letters, digits and
+ * underscores, and do not start with a digit.
+ */
+bool journal_field_name_is_valid(const char *name) {
+        unsigned long length = strlen(name);
+
+        if (length == 0 || length > 64)
+                return false;
+
+        if (name[0] >= '0' && name[0] <= '9')
+                return false;
+
+        for (unsigned long i = 0; i < length; i += 1) {
+                char c = name[i];
+
+                if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+                        return false;
+        }
+
+        return true;
+}
+
+void entry_fields_clear(EntryFields *fields) {
+        for (unsigned long i = 0; i < fields->n_extra; i += 1)
+                free(fields->extra[i]);
+
+        free(fields->extra);
+
+        *fields = (EntryFields){};
+}
+
+void entry_fields_add_extra(EntryFields *fields, const char *name) {
+        unsigned long i;
+
+        for (i = 0; i < fields->n_extra; i += 1) {
+                int c = strcmp(fields->extra[i], name);
+
+                if (c == 0)
+                        return;
+
+                if (c > 0)
+                        break;
+        }
+
+        fields->extra = realloc(fields->extra, (fields->n_extra + 1) * sizeof(char *));
+        memmove(fields->extra + i + 1, fields->extra + i, (fields->n_extra - i) * sizeof(char *));
+        fields->extra[i] = strdup(name);
+        fields->n_extra += 1;
+}
+
+void entry_fields_copy(EntryFields *fields, const EntryFields *other) {
+        *fields = (EntryFields) {
+                .mask = other->mask,
+                .max_message_bytes = other->max_message_bytes
+        };
+
+        for (unsigned long i = 0; i < other->n_extra; i += 1)
+                entry_fields_add_extra(fields, other->extra[i]);
+}
+
+/* Adds the fields of @other, and raises the message limit to its one. */
+void entry_fields_merge(EntryFields *fields, const EntryFields *other) {
+        fields->mask |= other->mask;
+
+        if (fields->max_message_bytes > 0 &&
+            (other->max_message_bytes == 0 || other->max_message_bytes > fields->max_message_bytes))
+                fields->max_message_bytes = other->max_message_bytes;
+
+        for (unsigned long i = 0; i < other->n_extra; i += 1)
+                entry_fields_add_extra(fields, other->extra[i]);
+}
+
+bool entry_fields_equal(const EntryFields *a, const EntryFields *b) {
+        if (a->mask != b->mask || a->n_extra != b->n_extra || a->max_message_bytes != b->max_message_bytes)
+                return false;
+
+        for (unsigned long i = 0; i < a->n_extra; i += 1)
+                if (strcmp(a->extra[i], b->extra[i]) != 0)
+                        return false;
+
+        return true;
+}
+
+Entry *entry_ref(Entry *entry) {
+        __atomic_add_fetch(&entry->n_refs, 1, __ATOMIC_RELAXED);
+
+        return entry;
+}
+
+Entry *entry_unref(Entry *entry) {
+        if (__atomic_sub_fetch(&entry->n_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                while (entry->objects) {
+                        EntryObject *object = entry->objects;
+
+                        entry->objects = object->next;
+                        varlink_object_unref(object->object);
+                        free(object);
+                }
+
+                STATS_ADD(buffered_bytes, -entry->size);
+
+                /* the strings are part of the entry's allocation */
+                free(entry);
+        }
+
+        return NULL;
+}
+
+void entry_unrefp(Entry **entryp) {
+        if (*entryp)
+                entry_unref(*entryp);
+}
+
+/*
+ * An entry is built as a single allocation, which holds its strings after
+ * the struct and the extra values. The values are copied out of the journal
+ * right away, because they only stay valid until the next field is read.
+ * While the entry grows, the strings are referred to by their offset.
+ */
+typedef struct {
+        Entry *entry;
+        unsigned long size;
+        unsigned long allocated;
+
+        /* all values are valid UTF-8 without NUL bytes */
+        bool valid_utf8;
+} EntryBuilder;
+
+static void entry_builder_clear(EntryBuilder *builder) {
+        free(builder->entry);
+}
+
+static unsigned long entry_builder_append(EntryBuilder *builder, const char *data, unsigned long length) {
+        unsigned long offset = builder->size;
+        uint64_t start = profile_begin();
+
+        if (builder->size + length + 1 > builder->allocated) {
+                builder->allocated = MAX(builder->allocated * 2, builder->size + length + 1);
+                builder->entry = realloc(builder->entry, builder->allocated);
+        }
+
+        memcpy((char *)builder->entry + offset, data, length);
+        ((char *)builder->entry)[offset + length] = '\0';
+        builder->size += length + 1;
+
+        stats_profile(PROFILE_COPY, start);
+
+        return offset;
+}
+
+/* Appends the value of @field, the offset is 0 if it is missing. */
+static long entry_builder_append_field(EntryBuilder *builder,
+                                       sd_journal *journal,
+                                       const char *field,
+                                       unsigned long *offsetp,
+                                       unsigned long *lengthp) {
+        const char *value;
+        unsigned long length;
+        long r;
+
+        r = journal_get_value(journal, field, &value, &length);
+        if (r == -ENOENT) {
+                *offsetp = 0;
+                *lengthp = 0;
+                return 0;
+        }
+        if (r < 0)
+                return r;
+
+        if (builder->valid_utf8 && !utf8_is_valid(value, length))
+                builder->valid_utf8 = false;
+
+        *offsetp = entry_builder_append(builder, value, length);
+        *lengthp = length;
+
+        return 0;
+}
+
+static const char *entry_get_string(Entry *entry, unsigned long offset) {
+        if (offset == 0)
+                return NULL;
+
+        return (const char *)entry + offset;
+}
+
+/*
+ * Reads the current entry, with only the given @fields. The timestamps and
+ * boot id are always read. An entry whose message does not match @grep is
+ * skipped before anything is decoded: 1 is returned, but no entry.
+ */
+static long journal_read_entry(sd_journal *journal, const EntryFields *fields, const Grep *grep, Entry **entryp) {
+        _cleanup_(freep) char *cursor = NULL;
+        _cleanup_(entry_builder_clear) EntryBuilder builder = {
+                .valid_utf8 = true
+        };
+        unsigned long cursor_offset = 0;
+        unsigned long message_offset = 0;
+        unsigned long process_offset = 0;
+        unsigned long process_length = 0;
+        unsigned long message_length = 0;
+        unsigned long message_original_length = 0;
+        unsigned long values_size = fields->n_extra * sizeof(EntryValue);
+        uint64_t realtime_usec;
+        uint64_t monotonic_usec;
+        sd_id128_t boot_id;
+        uint64_t priority = UINT64_MAX;
+        uint64_t pid = UINT64_MAX;
+        uint64_t uid = UINT64_MAX;
+        Entry *entry;
+        long r;
+
+        if (grep) {
+                uint64_t start = profile_begin();
+
+                r = journal_test_message(journal, grep);
+                stats_profile(PROFILE_GREP, start);
+                if (r < 0)
+                        return r;
+
+                if (r == 0) {
+                        *entryp = NULL;
+                        return 1;
+                }
+        }
+
+        r = sd_journal_get_realtime_usec(journal, &realtime_usec);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_get_monotonic_usec(journal, &monotonic_usec, &boot_id);
+        if (r < 0)
+                return r;
+
+        /* a malformed number is treated like a missing one */
+        if (fields->mask & ENTRY_FIELD_PRIORITY)
+                journal_get_unsigned(journal, "PRIORITY", &priority);
+
+        if (fields->mask & ENTRY_FIELD_PID)
+                journal_get_unsigned(journal, "_PID", &pid);
+
+        if (fields->mask & ENTRY_FIELD_UID)
+                journal_get_unsigned(journal, "_UID", &uid);
+
+        /* most entries fit, longer ones grow it */
+        builder.size = sizeof(Entry) + values_size;
+        builder.allocated = builder.size + 512;
+        builder.entry = calloc(1, builder.allocated);
+
+        if (fields->mask & ENTRY_FIELD_CURSOR) {
+                r = sd_journal_get_cursor(journal, &cursor);
+                if (r < 0)
+                        return r;
+
+                cursor_offset = entry_builder_append(&builder, cursor, strlen(cursor));
+        }
+
+        if (fields->mask & ENTRY_FIELD_MESSAGE) {
+                const char *message;
+
+                r = journal_get_value(journal, "MESSAGE", &message, &message_original_length);
+                if (r < 0 && r != -ENOENT)
+                        return r;
+
+                if (r >= 0) {
+                        message_length = message_original_length;
+                        if (fields->max_message_bytes > 0)
+                                message_length = utf8_truncate_length(message, message_length, fields->max_message_bytes);
+
+                        if (!utf8_is_valid(message, message_length))
+                                builder.valid_utf8 = false;
+
+                        message_offset = entry_builder_append(&builder, message, message_length);
+                }
+        }
+
+        if (fields->mask & ENTRY_FIELD_PROCESS) {
+                r = entry_builder_append_field(&builder, journal, "SYSLOG_IDENTIFIER", &process_offset, &process_length);
+                if (r >= 0 && process_offset == 0)
+                        r = entry_builder_append_field(&builder, journal, "_COMM", &process_offset, &process_length);
+                if (r < 0)
+                        return r;
+        }
+
+        for (unsigned long i = 0; i < fields->n_extra; i += 1) {
+                unsigned long name_offset;
+                unsigned long value_offset;
+                unsigned long value_length;
+
+                r = entry_builder_append_field(&builder, journal, fields->extra[i], &value_offset, &value_length);
+                if (r < 0)
+                        return r;
+
+                name_offset = entry_builder_append(&builder, fields->extra[i], strlen(fields->extra[i]));
+
+                /* the entry may have moved */
+                ((EntryValue *)(builder.entry + 1))[i] = (EntryValue) {
+                        .name = name_offset,
+                        .value = value_offset,
+                        .value_length = value_length
+                };
+        }
+
+        /* shrinks in place */
+        entry = realloc(builder.entry, builder.size);
+        builder.entry = NULL;
+
+        entry->n_refs = 1;
+        entry->mask = fields->mask;
+        entry->max_message_bytes = fields->max_message_bytes;
+        entry->realtime_usec = realtime_usec;
+        entry->monotonic_usec = monotonic_usec;
+        entry->boot_id = boot_id;
+        entry->priority = priority <= 7 ? (int)priority : -1;
+        entry->pid = pid <= INT64_MAX ? (int64_t)pid : -1;
+        entry->uid = uid <= INT64_MAX ? (int64_t)uid : -1;
+        entry->cursor = entry_get_string(entry, cursor_offset);
+        entry->message = entry_get_string(entry, message_offset);
+        entry->message_length = message_length;
+        entry->message_original_length = message_original_length;
+        entry->process = entry_get_string(entry, process_offset);
+        entry->process_length = process_length;
+        entry->valid_utf8 = builder.valid_utf8;
+
+        if (fields->n_extra > 0) {
+                entry->extra = (EntryValue *)(entry + 1);
+                entry->n_extra = fields->n_extra;
+        }
+
+        /* the time, field names, quotes and separators take less than
+         * 128 bytes, and 8 more per extra field */
+        entry->size = 128 + 8 * fields->n_extra + builder.size - sizeof(Entry) - values_size;
+
+        STATS_ADD(entries_read, 1);
+        STATS_ADD(bytes_read, entry->size);
+        STATS_ADD(buffered_bytes, entry->size);
+
+        PROBE(entry_read, entry->size, entry->realtime_usec, entry->cursor);
+
+        *entryp = entry;
+
+        return 1;
+}
+
+long journal_read_next_entry(sd_journal *journal, const EntryFields *fields, const Grep *grep, Entry **entryp) {
+        uint64_t start = profile_begin();
+        long r;
+
+        r = sd_journal_next(journal);
+        stats_profile(PROFILE_JOURNAL_NEXT, start);
+        if (r <= 0)
+                return r;
+
+        start = profile_begin();
+        r = journal_read_entry(journal, fields, grep, entryp);
+        stats_profile(PROFILE_READ_ENTRY, start);
+
+        return r;
+}
+
+long journal_read_previous_entry(sd_journal *journal, const EntryFields *fields, const Grep *grep, Entry **entryp) {
+        uint64_t start = profile_begin();
+        long r;
+
+        r = sd_journal_previous(journal);
+        stats_profile(PROFILE_JOURNAL_NEXT, start);
+        if (r <= 0)
+                return r;
+
+        start = profile_begin();
+        r = journal_read_entry(journal, fields, grep, entryp);
+        stats_profile(PROFILE_READ_ENTRY, start);
+
+        return r;
+}
+
+const char *entry_get_extra(Entry *entry, const char *name, unsigned long *lengthp) {
+        for (unsigned long i = 0; i < entry->n_extra; i += 1) {
+                if (strcmp(entry_get_string(entry, entry->extra[i].name), name) == 0) {
+                        *lengthp = entry->extra[i].value_length;
+                        return entry_get_string(entry, entry->extra[i].value);
+                }
+        }
+
+        return NULL;
+}
+
+/* Returns true if all of @fields were read for @entry. */
+bool entry_has_fields(Entry *entry, const EntryFields *fields) {
+        if ((entry->mask & fields->mask) != fields->mask)
+                return false;
+
+        /* the message was cut shorter than asked for */
+        if (entry->message_length < entry->message_original_length &&
+            (fields->max_message_bytes == 0 || fields->max_message_bytes > entry->max_message_bytes))
+                return false;
+
+        /* both lists are sorted */
+        for (unsigned long i = 0, k = 0; i < fields->n_extra; i += 1) {
+                while (k < entry->n_extra && strcmp(entry_get_string(entry, entry->extra[k].name), fields->extra[i]) < 0)
+                        k += 1;
+
+                if (k == entry->n_extra || strcmp(entry_get_string(entry, entry->extra[k].name), fields->extra[i]) != 0)
+                        return false;
+        }
+
+        return true;
+}
+
+VarlinkObject *entry_get_object(Entry *entry, unsigned long view_id) {
+        for (EntryObject *object = __atomic_load_n(&entry->objects, __ATOMIC_ACQUIRE); object; object = object->next)
+                if (object->view_id == view_id)
+                        return object->object;
+
+        return NULL;
+}
+
+void entry_set_object(Entry *entry, unsigned long view_id, VarlinkObject *object) {
+        EntryObject *entry_object;
+
+        entry_object = calloc(1, sizeof(EntryObject));
+        entry_object->view_id = view_id;
+        entry_object->object = varlink_object_ref(object);
+
+        /* views of other threads may add theirs at the same time */
+        entry_object->next = __atomic_load_n(&entry->objects, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&entry->objects,
+                                            &entry_object->next,
+                                            entry_object,
+                                            true,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+                ;
+}
+
+void entry_array_free(Entry **entries, unsigned long n_entries) {
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                entry_unref(entries[i]);
+
+        free(entries);
+}
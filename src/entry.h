@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <systemd/sd-journal.h>
+#include <varlink.h>
+
+#include "grep.h"
+
+typedef struct EntryObject EntryObject;
+typedef struct EntryValue EntryValue;
+
+enum {
+        ENTRY_FIELD_CURSOR   = 1 << 0,
+        ENTRY_FIELD_MESSAGE  = 1 << 1,
+        ENTRY_FIELD_PRIORITY = 1 << 2,
+        ENTRY_FIELD_PROCESS  = 1 << 3,
+        ENTRY_FIELD_PID      = 1 << 4,
+        ENTRY_FIELD_UID      = 1 << 5,
+
+        ENTRY_FIELDS_DEFAULT = ENTRY_FIELD_MESSAGE | ENTRY_FIELD_PRIORITY | ENTRY_FIELD_PROCESS
+};
+
+/*
+ * A set of fields to read from the journal: the ENTRY_FIELD_* ones in
+ * @mask, and the journal fields named in @extra, kept sorted. Messages
+ * are cut after @max_message_bytes, 0 means no limit.
+ */
+typedef struct {
+        unsigned int mask;
+        char **extra;
+        unsigned long n_extra;
+        unsigned long max_message_bytes;
+} EntryFields;
+
+/*
+ * A decoded journal entry. Entries are decoded once by a feed and shared
+ * by reference between every monitor that receives them, in all threads;
+ * only the references and the list of objects change after decoding. The
+ * strings and extra values are stored in the same allocation.
+ */
+typedef struct {
+        unsigned long n_refs;
+
+        /* the fields that were read */
+        unsigned int mask;
+        unsigned long max_message_bytes;
+
+        const char *cursor;
+        uint64_t realtime_usec;
+        uint64_t monotonic_usec;
+        sd_id128_t boot_id;
+        const char *message;
+        const char *process;
+        unsigned long process_length;
+
+        /* the length of @message, and of the message in the journal,
+         * which is larger if it was cut */
+        unsigned long message_length;
+        unsigned long message_original_length;
+
+        int priority;
+
+        /* -1 if missing */
+        int64_t pid;
+        int64_t uid;
+
+        EntryValue *extra;
+        unsigned long n_extra;
+
+        /* all strings are valid UTF-8 without NUL bytes */
+        bool valid_utf8;
+
+        /* estimated size of the serialized entry */
+        unsigned long size;
+
+        /* when a feed read it, in CLOCK_MONOTONIC; 0 if it was read otherwise */
+        uint64_t arrival_usec;
+
+        /* the varlink representations, built on first use for each view;
+         * an object is only used by the thread of its view */
+        EntryObject *objects;
+} Entry;
+
+Entry *entry_ref(Entry *entry);
+Entry *entry_unref(Entry *entry);
+void entry_unrefp(Entry **entryp);
+
+bool journal_field_name_is_valid(const char *name);
+
+void entry_fields_clear(EntryFields *fields);
+void entry_fields_add_extra(EntryFields *fields, const char *name);
+void entry_fields_copy(EntryFields *fields, const EntryFields *other);
+void entry_fields_merge(EntryFields *fields, const EntryFields *other);
+bool entry_fields_equal(const EntryFields *a, const EntryFields *b);
+
+long journal_get_value(sd_journal *journal, const char *field, const char **valuep, unsigned long *lengthp);
+long journal_get_unsigned(sd_journal *journal, const char *field, uint64_t *numberp);
+long journal_test_message(sd_journal *journal, const Grep *grep);
+void journal_set_data_threshold(sd_journal *journal, const EntryFields *fields, const Grep *grep);
+long journal_read_next_entry(sd_journal *journal, const EntryFields *fields, const Grep *grep, Entry **entryp);
+long journal_read_previous_entry(sd_journal *journal, const EntryFields *fields, const Grep *grep, Entry **entryp);
+
+bool entry_has_fields(Entry *entry, const EntryFields *fields);
+const char *entry_get_extra(Entry *entry, const char *name, unsigned long *lengthp);
+
+VarlinkObject *entry_get_object(Entry *entry, unsigned long view_id);
+void entry_set_object(Entry *entry, unsigned long view_id, VarlinkObject *object);
+
+void entry_array_free(Entry **entries, unsigned long n_entries);
@@ -0,0 +1,620 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "feed.h"
+#include "probes.h"
+#include "queue.h"
+#include "stats.h"
+#include "util.h"
+
+/*
+ * Every feed is a thread with a journal of its own, which has all journal
+ * files open. Readers with other filters share the unfiltered feed.
+ */
+#define MAX_FILTERED_FEEDS 16
+
+typedef struct Feed Feed;
+
+struct FeedSet {
+        /* protects the list of feeds */
+        pthread_mutex_t lock;
+        Feed *feeds;
+        unsigned long n_filtered_feeds;
+
+        unsigned long batch_size;
+        unsigned long max_batches;
+};
+
+struct Feed {
+        Feed *next;
+        Feed *previous;
+
+        pthread_t thread;
+        bool started;
+
+        /* only used by the thread once it is started */
+        sd_journal *journal;
+        Grep *grep;
+        EntryFields fields;
+        unsigned long batch_size;
+
+        /* wakes the thread up to stop, or when a full queue has room */
+        int wake_fd;
+        bool stop;
+        bool waiting;
+
+        /* why the thread stopped reading */
+        long error;
+
+        /* does not change */
+        Filter filter;
+
+        /* protects the queues and the cursor, which only the thread changes */
+        pthread_mutex_t lock;
+        FeedQueue *queues;
+        bool fields_changed;
+        char *cursor;
+};
+
+struct FeedQueue {
+        FeedQueue *next;
+        FeedQueue *previous;
+
+        FeedSet *set;
+        Feed *feed;
+
+        Queue *queue;
+        int ready_fd;
+        EntryFields fields;
+
+        /* on the unfiltered feed in place of a feed of @filter */
+        bool unfiltered;
+        Filter filter;
+};
+
+static FeedBatch *feed_batch_copy(FeedBatch *batch) {
+        FeedBatch *copy;
+
+        copy = calloc(1, sizeof(FeedBatch));
+        copy->entries = calloc(MAX(batch->n_entries, 1), sizeof(Entry *));
+        for (unsigned long i = 0; i < batch->n_entries; i += 1)
+                copy->entries[i] = entry_ref(batch->entries[i]);
+
+        copy->n_entries = batch->n_entries;
+        copy->cursor = strdup(batch->cursor);
+
+        return copy;
+}
+
+/* Positions the journal so that the next entry read follows the cursor. */
+static long feed_seek_cursor(Feed *feed) {
+        long r;
+
+        if (!feed->cursor)
+                return sd_journal_seek_head(feed->journal);
+
+        r = sd_journal_seek_cursor(feed->journal, feed->cursor);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_next(feed->journal);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
+static bool feed_is_full(Feed *feed) {
+        bool full = false;
+
+        pthread_mutex_lock(&feed->lock);
+        for (FeedQueue *queue = feed->queues; queue; queue = queue->next) {
+                if (queue_is_full(queue->queue)) {
+                        full = true;
+                        break;
+                }
+        }
+        pthread_mutex_unlock(&feed->lock);
+
+        return full;
+}
+
+static void feed_update_fields(Feed *feed) {
+        pthread_mutex_lock(&feed->lock);
+        if (feed->fields_changed) {
+                entry_fields_clear(&feed->fields);
+
+                /* merging into cleared fields would lift the message limit */
+                if (feed->queues)
+                        entry_fields_copy(&feed->fields, &feed->queues->fields);
+
+                for (FeedQueue *queue = feed->queues; queue; queue = queue->next)
+                        entry_fields_merge(&feed->fields, &queue->fields);
+
+                feed->fields_changed = false;
+        }
+        pthread_mutex_unlock(&feed->lock);
+}
+
+/* Hands @batch to all queues, which have room for it. */
+static void feed_push(Feed *feed, FeedBatch *batch) {
+        PROBE(batch_read, batch->n_entries, batch->cursor);
+
+        pthread_mutex_lock(&feed->lock);
+
+        free(feed->cursor);
+        feed->cursor = strdup(batch->cursor);
+
+        for (FeedQueue *queue = feed->queues; queue; queue = queue->next) {
+                queue_push(queue->queue, queue->next ? feed_batch_copy(batch) : batch);
+                eventfd_write(queue->ready_fd, 1);
+
+                if (!queue->next)
+                        batch = NULL;
+        }
+
+        pthread_mutex_unlock(&feed->lock);
+
+        /* the last queue went away */
+        if (batch)
+                feed_batch_free(batch);
+}
+
+/*
+ * Reads the next batch and queues it, if anything was read. Returns 1 once
+ * there is nothing more to read.
+ */
+static long feed_read_batch(Feed *feed) {
+        _cleanup_(feed_batch_freep) FeedBatch *batch = NULL;
+        bool skipped = false;
+        bool done = false;
+        long r;
+
+        feed_update_fields(feed);
+        journal_set_data_threshold(feed->journal, &feed->fields, feed->grep);
+
+        batch = calloc(1, sizeof(FeedBatch));
+        batch->entries = calloc(feed->batch_size, sizeof(Entry *));
+
+        while (batch->n_entries < feed->batch_size) {
+                Entry *entry;
+
+                r = journal_read_next_entry(feed->journal, &feed->fields, feed->grep, &entry);
+                if (r < 0)
+                        return r;
+
+                if (r == 0) {
+                        done = true;
+                        break;
+                }
+
+                /* not matching the patterns, but read past */
+                if (!entry) {
+                        skipped = true;
+                        continue;
+                }
+
+                entry->arrival_usec = now(CLOCK_MONOTONIC);
+
+                batch->entries[batch->n_entries] = entry;
+                batch->n_entries += 1;
+        }
+
+        if (batch->n_entries == 0 && !skipped)
+                return 1;
+
+        /* next() failed at the end, the journal is still on the last entry */
+        r = sd_journal_get_cursor(feed->journal, &batch->cursor);
+        if (r < 0)
+                return r;
+
+        feed_push(feed, batch);
+        batch = NULL;
+
+        return done;
+}
+
+static void *feed_run(void *userdata) {
+        Feed *feed = userdata;
+        struct pollfd fds[] = {
+                { .fd = sd_journal_get_fd(feed->journal), .events = POLLIN },
+                { .fd = feed->wake_fd, .events = POLLIN }
+        };
+        bool pending = true;
+        long r = 0;
+
+        stats_thread_start();
+
+        while (!__atomic_load_n(&feed->stop, __ATOMIC_ACQUIRE)) {
+                eventfd_t value;
+
+                /* a queue that takes a batch wakes us up if we wait for
+                 * room, the flag is set before looking */
+                if (pending) {
+                        __atomic_store_n(&feed->waiting, true, __ATOMIC_SEQ_CST);
+                        if (!feed_is_full(feed)) {
+                                __atomic_store_n(&feed->waiting, false, __ATOMIC_RELAXED);
+
+                                r = feed_read_batch(feed);
+                                if (r < 0)
+                                        break;
+
+                                pending = (r == 0);
+                                continue;
+                        }
+                }
+
+                if (poll(fds, ARRAY_SIZE(fds), -1) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        break;
+                }
+
+                if (fds[1].revents & POLLIN)
+                        eventfd_read(feed->wake_fd, &value);
+
+                if (fds[0].revents & POLLIN) {
+                        switch (sd_journal_process(feed->journal)) {
+                                case SD_JOURNAL_INVALIDATE:
+                                        PROBE(journal_invalidate, feed->cursor);
+                                        r = feed_seek_cursor(feed);
+                                        pending = true;
+                                        break;
+
+                                case SD_JOURNAL_APPEND:
+                                        pending = true;
+                                        break;
+
+                                default:
+                                        break;
+                        }
+
+                        if (r < 0)
+                                break;
+                }
+        }
+
+        if (r < 0) {
+                __atomic_store_n(&feed->error, r, __ATOMIC_RELEASE);
+
+                pthread_mutex_lock(&feed->lock);
+                for (FeedQueue *queue = feed->queues; queue; queue = queue->next)
+                        eventfd_write(queue->ready_fd, 1);
+                pthread_mutex_unlock(&feed->lock);
+        }
+
+        stats_thread_stop();
+
+        return NULL;
+}
+
+static Feed *feed_free(Feed *feed) {
+        if (feed->started) {
+                __atomic_store_n(&feed->stop, true, __ATOMIC_RELEASE);
+                eventfd_write(feed->wake_fd, 1);
+                pthread_join(feed->thread, NULL);
+        }
+
+        if (feed->journal)
+                sd_journal_close(feed->journal);
+
+        if (feed->wake_fd >= 0)
+                close(feed->wake_fd);
+
+        if (feed->grep)
+                grep_free(feed->grep);
+
+        pthread_mutex_destroy(&feed->lock);
+        entry_fields_clear(&feed->fields);
+        filter_clear(&feed->filter);
+        free(feed->cursor);
+        free(feed);
+
+        return NULL;
+}
+
+static void feed_freep(Feed **feedp) {
+        if (*feedp)
+                feed_free(*feedp);
+}
+
+/* The feed starts after the last entry of the journal. */
+static long feed_new(Feed **feedp, const Filter *filter, unsigned long batch_size) {
+        _cleanup_(feed_freep) Feed *feed = NULL;
+        sigset_t mask;
+        sigset_t old_mask;
+        long r;
+
+        feed = calloc(1, sizeof(Feed));
+        feed->wake_fd = -1;
+        feed->batch_size = MAX(batch_size, 1);
+        pthread_mutex_init(&feed->lock, NULL);
+        filter_copy(&feed->filter, filter);
+
+        feed->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (feed->wake_fd < 0)
+                return -errno;
+
+        r = sd_journal_open(&feed->journal, SD_JOURNAL_LOCAL_ONLY);
+        if (r < 0)
+                return r;
+
+        /* Makes sure the inotify watches exist before the first
+         * sd_journal_process() call. */
+        if (sd_journal_get_fd(feed->journal) < 0)
+                return -EBADF;
+
+        r = filter_apply(&feed->filter, feed->journal);
+        if (r < 0)
+                return r;
+
+        if (filter->n_patterns > 0) {
+                r = grep_new(&feed->grep, feed->filter.patterns, feed->filter.n_patterns);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_journal_seek_tail(feed->journal);
+        if (r >= 0)
+                r = sd_journal_previous(feed->journal);
+        if (r > 0)
+                r = sd_journal_get_cursor(feed->journal, &feed->cursor);
+        if (r < 0)
+                return r;
+
+        /* signals are handled by the main thread */
+        sigfillset(&mask);
+        pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+        r = -pthread_create(&feed->thread, NULL, feed_run, feed);
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        if (r < 0)
+                return r;
+
+        feed->started = true;
+
+        *feedp = feed;
+        feed = NULL;
+
+        return 0;
+}
+
+long feed_set_new(FeedSet **setp, unsigned long batch_size, unsigned long max_batches) {
+        FeedSet *set;
+
+        set = calloc(1, sizeof(FeedSet));
+        pthread_mutex_init(&set->lock, NULL);
+        set->batch_size = batch_size;
+        set->max_batches = max_batches;
+
+        *setp = set;
+
+        return 0;
+}
+
+/* All queues are gone, and with them the feeds. */
+FeedSet *feed_set_free(FeedSet *set) {
+        while (set->feeds) {
+                Feed *feed = set->feeds;
+
+                set->feeds = feed->next;
+                feed_free(feed);
+        }
+
+        pthread_mutex_destroy(&set->lock);
+        free(set);
+
+        return NULL;
+}
+
+void feed_set_freep(FeedSet **setp) {
+        if (*setp)
+                feed_set_free(*setp);
+}
+
+static Feed *feed_set_find(FeedSet *set, const Filter *filter) {
+        for (Feed *feed = set->feeds; feed; feed = feed->next)
+                if (filter_equal(&feed->filter, filter))
+                        return feed;
+
+        return NULL;
+}
+
+/*
+ * A reader on the unfiltered feed matches the entries itself, and keeps the
+ * cursor of the last one that matched.
+ */
+static void feed_queue_add_match_fields(FeedQueue *queue) {
+        filter_add_fields(&queue->filter, &queue->fields);
+        queue->fields.mask |= ENTRY_FIELD_CURSOR;
+}
+
+long feed_queue_new(FeedQueue **queuep,
+                    FeedSet *set,
+                    const Filter *filter,
+                    const EntryFields *fields,
+                    int ready_fd,
+                    char **cursorp) {
+        static const Filter no_filter = {};
+        FeedQueue *queue;
+        Feed *feed;
+        long r;
+
+        queue = calloc(1, sizeof(FeedQueue));
+        queue->set = set;
+        queue->ready_fd = ready_fd;
+        entry_fields_copy(&queue->fields, fields);
+
+        r = queue_new(&queue->queue, set->max_batches);
+        if (r < 0) {
+                entry_fields_clear(&queue->fields);
+                free(queue);
+                return r;
+        }
+
+        pthread_mutex_lock(&set->lock);
+
+        feed = feed_set_find(set, filter);
+        if (!feed && !filter_is_empty(filter) && set->n_filtered_feeds >= MAX_FILTERED_FEEDS) {
+                queue->unfiltered = true;
+                filter_copy(&queue->filter, filter);
+                feed_queue_add_match_fields(queue);
+
+                filter = &no_filter;
+                feed = feed_set_find(set, filter);
+        }
+
+        if (!feed) {
+                r = feed_new(&feed, filter, set->batch_size);
+                if (r < 0) {
+                        pthread_mutex_unlock(&set->lock);
+                        queue_free(queue->queue);
+                        entry_fields_clear(&queue->fields);
+                        filter_clear(&queue->filter);
+                        free(queue);
+                        return r;
+                }
+
+                if (!filter_is_empty(filter))
+                        set->n_filtered_feeds += 1;
+
+                feed->next = set->feeds;
+                if (set->feeds)
+                        set->feeds->previous = feed;
+                set->feeds = feed;
+        }
+
+        queue->feed = feed;
+
+        /* batches queued from now on follow the cursor */
+        pthread_mutex_lock(&feed->lock);
+        queue->next = feed->queues;
+        if (feed->queues)
+                feed->queues->previous = queue;
+        feed->queues = queue;
+        feed->fields_changed = true;
+        *cursorp = feed->cursor ? strdup(feed->cursor) : NULL;
+        pthread_mutex_unlock(&feed->lock);
+
+        pthread_mutex_unlock(&set->lock);
+
+        *queuep = queue;
+
+        return 0;
+}
+
+/* Removes the queue from its feed, which is stopped if it was the last one. */
+FeedQueue *feed_queue_free(FeedQueue *queue) {
+        FeedSet *set = queue->set;
+        Feed *feed = queue->feed;
+        FeedBatch *batch;
+        bool unused;
+
+        pthread_mutex_lock(&set->lock);
+
+        pthread_mutex_lock(&feed->lock);
+        if (queue->previous)
+                queue->previous->next = queue->next;
+        else
+                feed->queues = queue->next;
+
+        if (queue->next)
+                queue->next->previous = queue->previous;
+
+        feed->fields_changed = true;
+        unused = !feed->queues;
+        pthread_mutex_unlock(&feed->lock);
+
+        if (unused) {
+                if (feed->previous)
+                        feed->previous->next = feed->next;
+                else
+                        set->feeds = feed->next;
+
+                if (feed->next)
+                        feed->next->previous = feed->previous;
+
+                if (!filter_is_empty(&feed->filter))
+                        set->n_filtered_feeds -= 1;
+
+                feed_free(feed);
+        } else
+                /* it might wait for room in this queue */
+                eventfd_write(feed->wake_fd, 1);
+
+        pthread_mutex_unlock(&set->lock);
+
+        while ((batch = queue_pop(queue->queue)))
+                feed_batch_free(batch);
+
+        queue_free(queue->queue);
+        entry_fields_clear(&queue->fields);
+        filter_clear(&queue->filter);
+        free(queue);
+
+        return NULL;
+}
+
+void feed_queue_freep(FeedQueue **queuep) {
+        if (*queuep)
+                feed_queue_free(*queuep);
+}
+
+/* Entries are read with @fields from the next batch on. */
+void feed_queue_set_fields(FeedQueue *queue, const EntryFields *fields) {
+        pthread_mutex_lock(&queue->feed->lock);
+        entry_fields_clear(&queue->fields);
+        entry_fields_copy(&queue->fields, fields);
+        if (queue->unfiltered)
+                feed_queue_add_match_fields(queue);
+        queue->feed->fields_changed = true;
+        pthread_mutex_unlock(&queue->feed->lock);
+}
+
+/*
+ * Takes the oldest batch of the queue, or returns NULL in @batchp if there
+ * is none. Returns the error of the feed once it stopped reading.
+ */
+long feed_queue_pop(FeedQueue *queue, FeedBatch **batchp) {
+        FeedBatch *batch;
+
+        batch = queue_pop(queue->queue);
+        if (!batch) {
+                *batchp = NULL;
+                return __atomic_load_n(&queue->feed->error, __ATOMIC_ACQUIRE);
+        }
+
+        if (__atomic_exchange_n(&queue->feed->waiting, false, __ATOMIC_SEQ_CST))
+                eventfd_write(queue->feed->wake_fd, 1);
+
+        *batchp = batch;
+
+        return 0;
+}
+
+bool feed_queue_has_batches(FeedQueue *queue) {
+        return !queue_is_empty(queue->queue);
+}
+
+bool feed_queue_is_unfiltered(FeedQueue *queue) {
+        return queue->unfiltered;
+}
+
+FeedBatch *feed_batch_free(FeedBatch *batch) {
+        entry_array_free(batch->entries, batch->n_entries);
+        free(batch->cursor);
+        free(batch);
+
+        return NULL;
+}
+
+void feed_batch_freep(FeedBatch **batchp) {
+        if (*batchp)
+                feed_batch_free(*batchp);
+}
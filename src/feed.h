@@ -0,0 +1,59 @@
+#pragma once
+
+#include "entry.h"
+#include "filter.h"
+
+/*
+ * A feed reads and decodes the entries that are appended to the journal
+ * in a thread of its own, so that neither a burst in the journal nor slow
+ * clients hold up the other side. There is one feed per filter, and it
+ * hands the same decoded entries to the queues of all readers with that
+ * filter, whatever thread they run in. Beyond a limit of feeds, queues get
+ * the entries of the unfiltered feed, which their readers have to match.
+ * Entries are read with the fields of all queues, in batches of at most
+ * @batch_size entries. A feed reads ahead by at most @max_batches batches
+ * that a queue did not take yet.
+ */
+typedef struct FeedSet FeedSet;
+typedef struct FeedQueue FeedQueue;
+
+/*
+ * @cursor is the position after the last entry read, which is set even if
+ * the patterns skipped all of them.
+ */
+typedef struct {
+        Entry **entries;
+        unsigned long n_entries;
+        char *cursor;
+} FeedBatch;
+
+long feed_set_new(FeedSet **setp, unsigned long batch_size, unsigned long max_batches);
+FeedSet *feed_set_free(FeedSet *set);
+void feed_set_freep(FeedSet **setp);
+
+/*
+ * Adds a queue to the feed of @filter, which is started if there is none,
+ * or to the unfiltered feed if there are too many. Its entries are then
+ * also read with their cursor and the fields that filter_match_entry()
+ * needs, except for the ones of the batch the feed is reading already.
+ * @ready_fd, an eventfd, is signalled when there are batches in the queue
+ * or the feed failed. The first batch follows the entry of @cursorp, or
+ * the first entry of the journal if it is NULL.
+ */
+long feed_queue_new(FeedQueue **queuep,
+                    FeedSet *set,
+                    const Filter *filter,
+                    const EntryFields *fields,
+                    int ready_fd,
+                    char **cursorp);
+FeedQueue *feed_queue_free(FeedQueue *queue);
+void feed_queue_freep(FeedQueue **queuep);
+
+void feed_queue_set_fields(FeedQueue *queue, const EntryFields *fields);
+
+long feed_queue_pop(FeedQueue *queue, FeedBatch **batchp);
+bool feed_queue_has_batches(FeedQueue *queue);
+bool feed_queue_is_unfiltered(FeedQueue *queue);
+
+FeedBatch *feed_batch_free(FeedBatch *batch);
+void feed_batch_freep(FeedBatch **batchp);
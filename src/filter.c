@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "entry.h"
+#include "filter.h"
+#include "util.h"
+
+bool journal_match_is_valid(const char *match) {
+        _cleanup_(freep) char *field = NULL;
+        const char *equals;
+
+        equals = strchr(match, '=');
+        if (!equals)
+                return false;
+
+        field = strndup(match, equals - match);
+
+        return journal_field_name_is_valid(field);
+}
+
+static void strv_add_sorted(char ***strvp, unsigned long *np, const char *string) {
+        unsigned long i;
+
+        for (i = 0; i < *np; i += 1) {
+                int c = strcmp((*strvp)[i], string);
+
+                if (c == 0)
+                        return;
+
+                if (c > 0)
+                        break;
+        }
+
+        *strvp = realloc(*strvp, (*np + 1) * sizeof(char *));
+        memmove(*strvp + i + 1, *strvp + i, (*np - i) * sizeof(char *));
+        (*strvp)[i] = strdup(string);
+        *np += 1;
+}
+
+static int strv_compare(char **a, unsigned long n_a, char **b, unsigned long n_b) {
+        for (unsigned long i = 0; i < n_a && i < n_b; i += 1) {
+                int c = strcmp(a[i], b[i]);
+
+                if (c != 0)
+                        return c;
+        }
+
+        return (n_a > n_b) - (n_a < n_b);
+}
+
+static bool strv_equal(char **a, unsigned long n_a, char **b, unsigned long n_b) {
+        return strv_compare(a, n_a, b, n_b) == 0;
+}
+
+void filter_term_add_match(FilterTerm *term, const char *match) {
+        strv_add_sorted(&term->matches, &term->n_matches, match);
+}
+
+void filter_term_add_field_match(FilterTerm *term, const char *field, const char *value) {
+        unsigned long field_length = strlen(field);
+        unsigned long value_length = strlen(value);
+        _cleanup_(freep) char *match = NULL;
+
+        match = malloc(field_length + 1 + value_length + 1);
+        memcpy(match, field, field_length);
+        match[field_length] = '=';
+        memcpy(match + field_length + 1, value, value_length + 1);
+
+        filter_term_add_match(term, match);
+}
+
+static bool filter_term_has_field(const FilterTerm *term, const char *match) {
+        unsigned long length = strchr(match, '=') - match + 1;
+
+        for (unsigned long i = 0; i < term->n_matches; i += 1)
+                if (strncmp(term->matches[i], match, length) == 0)
+                        return true;
+
+        return false;
+}
+
+static bool filter_term_has_match(const FilterTerm *term, const char *match) {
+        for (unsigned long i = 0; i < term->n_matches; i += 1)
+                if (strcmp(term->matches[i], match) == 0)
+                        return true;
+
+        return false;
+}
+
+/*
+ * Narrows @term to the entries that @other matches as well. On fields that
+ * both have matches on, only the values of both are kept. Returns false if
+ * none are left on one of them, @term then matches no entry.
+ */
+bool filter_term_intersect(FilterTerm *term, const FilterTerm *other) {
+        _cleanup_(filter_term_clear) FilterTerm result = {};
+
+        for (unsigned long i = 0; i < term->n_matches; i += 1)
+                if (!filter_term_has_field(other, term->matches[i]) ||
+                    filter_term_has_match(other, term->matches[i]))
+                        filter_term_add_match(&result, term->matches[i]);
+
+        for (unsigned long i = 0; i < term->n_matches; i += 1)
+                if (!filter_term_has_field(&result, term->matches[i]))
+                        return false;
+
+        for (unsigned long i = 0; i < other->n_matches; i += 1)
+                if (!filter_term_has_field(term, other->matches[i]))
+                        filter_term_add_match(&result, other->matches[i]);
+
+        filter_term_clear(term);
+        *term = result;
+        result = (FilterTerm){};
+
+        return true;
+}
+
+void filter_term_clear(FilterTerm *term) {
+        for (unsigned long i = 0; i < term->n_matches; i += 1)
+                free(term->matches[i]);
+
+        free(term->matches);
+
+        term->matches = NULL;
+        term->n_matches = 0;
+}
+
+/*
+ * Moves @term into @filter, an empty one or one that is already there is
+ * dropped. The terms are kept sorted, so that filters which only differ
+ * in their order are equal.
+ */
+void filter_add_term(Filter *filter, FilterTerm *term) {
+        unsigned long i;
+
+        if (term->n_matches == 0)
+                return;
+
+        for (i = 0; i < filter->n_terms; i += 1) {
+                int c = strv_compare(filter->terms[i].matches, filter->terms[i].n_matches,
+                                     term->matches, term->n_matches);
+
+                if (c == 0) {
+                        filter_term_clear(term);
+                        return;
+                }
+
+                if (c > 0)
+                        break;
+        }
+
+        filter->terms = realloc(filter->terms, (filter->n_terms + 1) * sizeof(FilterTerm));
+        memmove(filter->terms + i + 1, filter->terms + i, (filter->n_terms - i) * sizeof(FilterTerm));
+        filter->terms[i] = *term;
+        filter->n_terms += 1;
+
+        *term = (FilterTerm){};
+}
+
+void filter_add_pattern(Filter *filter, const char *pattern) {
+        strv_add_sorted(&filter->patterns, &filter->n_patterns, pattern);
+}
+
+bool filter_is_empty(const Filter *filter) {
+        return filter->n_terms == 0 && filter->n_patterns == 0;
+}
+
+void filter_copy(Filter *filter, const Filter *other) {
+        *filter = (Filter){};
+
+        for (unsigned long i = 0; i < other->n_terms; i += 1) {
+                FilterTerm term = {};
+
+                for (unsigned long k = 0; k < other->terms[i].n_matches; k += 1)
+                        filter_term_add_match(&term, other->terms[i].matches[k]);
+
+                filter_add_term(filter, &term);
+        }
+
+        for (unsigned long i = 0; i < other->n_patterns; i += 1)
+                filter_add_pattern(filter, other->patterns[i]);
+}
+
+void filter_clear(Filter *filter) {
+        for (unsigned long i = 0; i < filter->n_terms; i += 1)
+                filter_term_clear(&filter->terms[i]);
+
+        free(filter->terms);
+
+        for (unsigned long i = 0; i < filter->n_patterns; i += 1)
+                free(filter->patterns[i]);
+
+        free(filter->patterns);
+
+        *filter = (Filter){};
+}
+
+bool filter_equal(const Filter *a, const Filter *b) {
+        if (a->n_terms != b->n_terms)
+                return false;
+
+        for (unsigned long i = 0; i < a->n_terms; i += 1)
+                if (!strv_equal(a->terms[i].matches, a->terms[i].n_matches,
+                                b->terms[i].matches, b->terms[i].n_matches))
+                        return false;
+
+        return strv_equal(a->patterns, a->n_patterns, b->patterns, b->n_patterns);
+}
+
+/*
+ * Adds the fields that filter_match_entry() needs to @fields. The patterns
+ * are searched for in the whole message.
+ */
+void filter_add_fields(const Filter *filter, EntryFields *fields) {
+        for (unsigned long i = 0; i < filter->n_terms; i += 1) {
+                for (unsigned long k = 0; k < filter->terms[i].n_matches; k += 1) {
+                        const char *match = filter->terms[i].matches[k];
+                        _cleanup_(freep) char *field = NULL;
+
+                        field = strndup(match, strchr(match, '=') - match);
+                        entry_fields_add_extra(fields, field);
+                }
+        }
+
+        if (filter->n_patterns > 0) {
+                fields->mask |= ENTRY_FIELD_MESSAGE;
+                fields->max_message_bytes = 0;
+        }
+}
+
+static bool filter_term_match_entry(const FilterTerm *term, Entry *entry) {
+        unsigned long i = 0;
+
+        while (i < term->n_matches) {
+                const char *first = term->matches[i];
+                unsigned long name_length = strchr(first, '=') - first;
+                _cleanup_(freep) char *field = NULL;
+                const char *value;
+                unsigned long length = 0;
+                bool matched = false;
+
+                field = strndup(first, name_length);
+                value = entry_get_extra(entry, field, &length);
+
+                /* sorted, the matches on a field are next to each other */
+                for (; i < term->n_matches && strncmp(term->matches[i], first, name_length + 1) == 0; i += 1) {
+                        const char *match_value = term->matches[i] + name_length + 1;
+
+                        if (value && strlen(match_value) == length && memcmp(match_value, value, length) == 0)
+                                matched = true;
+                }
+
+                if (!matched)
+                        return false;
+        }
+
+        return true;
+}
+
+/*
+ * Tests @entry against the terms of @filter, as the journal does with its
+ * indexes. The entry needs the fields of filter_add_fields(). The patterns
+ * are left to the reader.
+ */
+bool filter_match_entry(const Filter *filter, Entry *entry) {
+        if (filter->n_terms == 0)
+                return true;
+
+        for (unsigned long i = 0; i < filter->n_terms; i += 1)
+                if (filter_term_match_entry(&filter->terms[i], entry))
+                        return true;
+
+        return false;
+}
+
+/*
+ * Adds the matches of @filter to @journal, before it is first positioned.
+ * The patterns are left to the reader.
+ */
+long filter_apply(const Filter *filter, sd_journal *journal) {
+        long r;
+
+        for (unsigned long i = 0; i < filter->n_terms; i += 1) {
+                for (unsigned long k = 0; k < filter->terms[i].n_matches; k += 1) {
+                        r = sd_journal_add_match(journal, filter->terms[i].matches[k], 0);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = sd_journal_add_disjunction(journal);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <systemd/sd-journal.h>
+
+#include "entry.h"
+
+/*
+ * A conjunction of FIELD=value matches, kept sorted. As in the journal,
+ * matches on the same field are alternatives.
+ */
+typedef struct {
+        char **matches;
+        unsigned long n_matches;
+} FilterTerm;
+
+/*
+ * A disjunction of terms, which the journal evaluates with its field
+ * indexes. Entries also need to have one of @patterns in their message,
+ * if there are any. A filter without terms and patterns matches every
+ * entry.
+ */
+typedef struct {
+        FilterTerm *terms;
+        unsigned long n_terms;
+
+        /* sorted */
+        char **patterns;
+        unsigned long n_patterns;
+} Filter;
+
+bool journal_match_is_valid(const char *match);
+
+void filter_term_add_match(FilterTerm *term, const char *match);
+void filter_term_add_field_match(FilterTerm *term, const char *field, const char *value);
+bool filter_term_intersect(FilterTerm *term, const FilterTerm *other);
+void filter_term_clear(FilterTerm *term);
+
+void filter_add_term(Filter *filter, FilterTerm *term);
+void filter_add_pattern(Filter *filter, const char *pattern);
+bool filter_is_empty(const Filter *filter);
+void filter_copy(Filter *filter, const Filter *other);
+void filter_clear(Filter *filter);
+bool filter_equal(const Filter *a, const Filter *b);
+void filter_add_fields(const Filter *filter, EntryFields *fields);
+bool filter_match_entry(const Filter *filter, Entry *entry);
+
+long filter_apply(const Filter *filter, sd_journal *journal);
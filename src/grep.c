@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "grep.h"
+#include "util.h"
+
+struct Grep {
+        /* with a single pattern */
+        char *pattern;
+        unsigned long pattern_length;
+
+        /* the automaton for several patterns, 256 transitions per state */
+        uint16_t *transitions;
+        bool *accepting;
+        unsigned long n_states;
+};
+
+#ifdef __SSE2__
+/*
+ * Compares the first and the last byte of the pattern at 16 positions at
+ * once, and only compares the rest where both match.
+ */
+static bool find_pattern(const char *text, unsigned long length, const char *pattern, unsigned long pattern_length) {
+        const __m128i first = _mm_set1_epi8(pattern[0]);
+        const __m128i last = _mm_set1_epi8(pattern[pattern_length - 1]);
+        unsigned long i = 0;
+
+        if (pattern_length > length)
+                return false;
+
+        for (; i + 16 + pattern_length - 1 <= length; i += 16) {
+                __m128i block_first = _mm_loadu_si128((const __m128i *)(text + i));
+                __m128i block_last = _mm_loadu_si128((const __m128i *)(text + i + pattern_length - 1));
+                unsigned int mask;
+
+                mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                       _mm_cmpeq_epi8(block_last, last)));
+
+                while (mask) {
+                        unsigned int bit = __builtin_ctz(mask);
+
+                        if (memcmp(text + i + bit + 1, pattern + 1, pattern_length - MIN(pattern_length, 2)) == 0)
+                                return true;
+
+                        mask &= mask - 1;
+                }
+        }
+
+        return memmem(text + i, length - i, pattern, pattern_length) != NULL;
+}
+#else
+static bool find_pattern(const char *text, unsigned long length, const char *pattern, unsigned long pattern_length) {
+        return memmem(text, length, pattern, pattern_length) != NULL;
+}
+#endif
+
+/*
+ * Builds the trie of all patterns, and turns it into a complete automaton
+ * by following the failure links breadth-first.
+ */
+static void grep_build_automaton(Grep *grep, char **patterns, unsigned long n_patterns) {
+        _cleanup_(freep) uint16_t *failure = NULL;
+        _cleanup_(freep) uint16_t *queue = NULL;
+        unsigned long n_states = 1;
+        unsigned long head = 0;
+        unsigned long tail = 0;
+        unsigned long max_states = 1;
+
+        for (unsigned long i = 0; i < n_patterns; i += 1)
+                max_states += strlen(patterns[i]);
+
+        /* 0 is the root, and means "no transition" while building the trie */
+        grep->transitions = calloc(max_states * 256, sizeof(uint16_t));
+        grep->accepting = calloc(max_states, sizeof(bool));
+        failure = calloc(max_states, sizeof(uint16_t));
+        queue = calloc(max_states, sizeof(uint16_t));
+
+        for (unsigned long i = 0; i < n_patterns; i += 1) {
+                unsigned long state = 0;
+
+                for (const unsigned char *p = (const unsigned char *)patterns[i]; *p; p += 1) {
+                        if (grep->transitions[state * 256 + *p] == 0) {
+                                grep->transitions[state * 256 + *p] = n_states;
+                                n_states += 1;
+                        }
+
+                        state = grep->transitions[state * 256 + *p];
+                }
+
+                grep->accepting[state] = true;
+        }
+
+        for (unsigned long c = 0; c < 256; c += 1) {
+                uint16_t next = grep->transitions[c];
+
+                if (next != 0) {
+                        failure[next] = 0;
+                        queue[tail++] = next;
+                }
+        }
+
+        while (head < tail) {
+                uint16_t state = queue[head++];
+
+                /* a pattern ends inside this one */
+                if (grep->accepting[failure[state]])
+                        grep->accepting[state] = true;
+
+                for (unsigned long c = 0; c < 256; c += 1) {
+                        uint16_t next = grep->transitions[state * 256 + c];
+
+                        if (next != 0) {
+                                failure[next] = grep->transitions[failure[state] * 256 + c];
+                                queue[tail++] = next;
+                        } else
+                                grep->transitions[state * 256 + c] = grep->transitions[failure[state] * 256 + c];
+                }
+        }
+
+        grep->n_states = n_states;
+}
+
+/*
+ * Returns -EINVAL for an empty pattern, and -E2BIG if the patterns are too
+ * long together.
+ */
+long grep_new(Grep **grepp, char **patterns, unsigned long n_patterns) {
+        _cleanup_(grep_freep) Grep *grep = NULL;
+        unsigned long length = 0;
+
+        if (n_patterns == 0)
+                return -EINVAL;
+
+        for (unsigned long i = 0; i < n_patterns; i += 1) {
+                if (patterns[i][0] == '\0')
+                        return -EINVAL;
+
+                length += strlen(patterns[i]);
+        }
+
+        if (length > GREP_PATTERNS_MAX_LENGTH)
+                return -E2BIG;
+
+        grep = calloc(1, sizeof(Grep));
+
+        if (n_patterns == 1) {
+                grep->pattern = strdup(patterns[0]);
+                grep->pattern_length = length;
+        } else
+                grep_build_automaton(grep, patterns, n_patterns);
+
+        *grepp = grep;
+        grep = NULL;
+
+        return 0;
+}
+
+Grep *grep_free(Grep *grep) {
+        free(grep->pattern);
+        free(grep->transitions);
+        free(grep->accepting);
+        free(grep);
+
+        return NULL;
+}
+
+void grep_freep(Grep **grepp) {
+        if (*grepp)
+                grep_free(*grepp);
+}
+
+bool grep_match(const Grep *grep, const char *text, unsigned long length) {
+        const unsigned char *p = (const unsigned char *)text;
+        unsigned long state = 0;
+
+        if (grep->pattern)
+                return find_pattern(text, length, grep->pattern, grep->pattern_length);
+
+        for (unsigned long i = 0; i < length; i += 1) {
+                state = grep->transitions[state * 256 + p[i]];
+                if (grep->accepting[state])
+                        return true;
+        }
+
+        return false;
+}
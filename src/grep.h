@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * Tests messages for any of a set of byte patterns. A single pattern is
+ * searched for with SIMD compares of its first and last byte, several
+ * with an Aho-Corasick automaton, which looks at every byte once.
+ */
+typedef struct Grep Grep;
+
+/* bounds the size of the automaton to 512 KiB */
+#define GREP_PATTERNS_MAX_LENGTH 1024
+
+long grep_new(Grep **grepp, char **patterns, unsigned long n_patterns);
+Grep *grep_free(Grep *grep);
+void grep_freep(Grep **grepp);
+
+bool grep_match(const Grep *grep, const char *text, unsigned long length);
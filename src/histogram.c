@@ -0,0 +1,73 @@
+#include "histogram.h"
+
+static unsigned long histogram_index(uint64_t usec) {
+        unsigned long bits;
+
+        if (usec >> HISTOGRAM_MAX_BITS)
+                return HISTOGRAM_N_BUCKETS - 1;
+
+        /* the smallest values have a bucket each */
+        if (usec < (1 << HISTOGRAM_SUB_BITS))
+                return usec;
+
+        bits = 64 - __builtin_clzll(usec);
+
+        return ((bits - HISTOGRAM_SUB_BITS) << HISTOGRAM_SUB_BITS) +
+               ((usec >> (bits - HISTOGRAM_SUB_BITS - 1)) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* Returns the largest value of bucket @index. */
+static uint64_t histogram_value(unsigned long index) {
+        unsigned long shift;
+        uint64_t sub;
+
+        if (index < (1 << HISTOGRAM_SUB_BITS))
+                return index;
+
+        shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+        sub = (1 << HISTOGRAM_SUB_BITS) + (index & ((1 << HISTOGRAM_SUB_BITS) - 1));
+
+        return ((sub + 1) << shift) - 1;
+}
+
+void histogram_add(Histogram *histogram, uint64_t usec) {
+        uint64_t *count = &histogram->counts[histogram_index(usec)];
+
+        __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+void histogram_merge(Histogram *histogram, const Histogram *other) {
+        for (unsigned long i = 0; i < HISTOGRAM_N_BUCKETS; i += 1)
+                histogram->counts[i] += __atomic_load_n(&other->counts[i], __ATOMIC_RELAXED);
+}
+
+uint64_t histogram_get_count(const Histogram *histogram) {
+        uint64_t count = 0;
+
+        for (unsigned long i = 0; i < HISTOGRAM_N_BUCKETS; i += 1)
+                count += histogram->counts[i];
+
+        return count;
+}
+
+uint64_t histogram_get_percentile(const Histogram *histogram, double fraction) {
+        uint64_t count = histogram_get_count(histogram);
+        uint64_t rank;
+
+        if (count == 0)
+                return 0;
+
+        /* the first value that at least @fraction of all values are not larger than */
+        rank = fraction * count;
+        if (rank < fraction * count || rank == 0)
+                rank += 1;
+
+        for (unsigned long i = 0; i < HISTOGRAM_N_BUCKETS; i += 1) {
+                if (histogram->counts[i] >= rank)
+                        return histogram_value(i);
+
+                rank -= histogram->counts[i];
+        }
+
+        return histogram_value(HISTOGRAM_N_BUCKETS - 1);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * A histogram of durations in microseconds, in buckets that are about
+ * 6% wide at every scale: each power of two is split into 16 buckets.
+ * Durations above 2^36 microseconds, about 19 hours, count as that.
+ */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 36
+#define HISTOGRAM_N_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+        uint64_t counts[HISTOGRAM_N_BUCKETS];
+} Histogram;
+
+/*
+ * Counts @usec. Only one thread may add to a histogram, others may read
+ * it at the same time.
+ */
+void histogram_add(Histogram *histogram, uint64_t usec);
+void histogram_merge(Histogram *histogram, const Histogram *other);
+
+uint64_t histogram_get_count(const Histogram *histogram);
+
+/* Returns the largest duration of the bucket that holds the @fraction quantile. */
+uint64_t histogram_get_percentile(const Histogram *histogram, double fraction);
@@ -1,49 +1,114 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/signalfd.h>
-#include <systemd/sd-journal.h>
-#include <time.h>
+#include <sys/timerfd.h>
 #include <varlink.h>
 
 #include "com.redhat.logging.varlink.c.inc"
+#include "probes.h"
+#include "reader.h"
+#include "stats.h"
 #include "util.h"
+#include "view.h"
 
 enum {
         ERROR_PANIC = 1,
         ERROR_MISSING_ADDRESS,
+        ERROR_INVALID_ARGUMENT,
 
         ERROR_MAX
 };
 
 static const char *error_strings[] = {
-        [ERROR_PANIC]           = "Panic",
-        [ERROR_MISSING_ADDRESS] = "MissingAddress"
+        [ERROR_PANIC]            = "Panic",
+        [ERROR_MISSING_ADDRESS]  = "MissingAddress",
+        [ERROR_INVALID_ARGUMENT] = "InvalidArgument"
 };
 
+/* batches a feed reads ahead of the slowest worker */
+#define MAX_FEED_BATCHES 16
+
+/* filters a worker opens a journal for at the same time */
+#define MAX_FILTER_READERS 16
+
+/*
+ * Events taken from epoll at once, and calls into the service per loop
+ * iteration; each call handles one event of one connection.
+ */
+#define MAX_EVENTS 64
+#define MAX_SERVICE_EVENTS 32
+
+/*
+ * The state shared by all method calls of a worker. Every worker accepts
+ * connections on the same socket and serves them in its own thread; only
+ * the feeds are shared.
+ */
+typedef struct {
+        int epoll_fd;
+        VarlinkService *service;
+        FeedSet *feeds;
+
+        /* expires when the first entries held back for monitors are due,
+         * or monitors that fell behind may read on */
+        int timer_fd;
+        uint64_t timer_usec;
+
+        /* the reader of all monitors without a filter, with the ring */
+        Reader *reader;
+
+        /* one reader for every filter the monitors use */
+        Reader **filter_readers;
+        unsigned long n_filter_readers;
+
+        unsigned long max_entries_per_reply;
+        unsigned long max_pending_entries;
+        unsigned long max_pending_bytes;
+        unsigned long max_message_bytes;
+        uint64_t max_delay_usec;
+        TimePrecision time_precision;
+
+        /* what the readers read at least */
+        EntryFields default_fields;
+
+        /* the views of all monitors */
+        View *views;
+} Server;
+
+typedef struct {
+        Server server;
+
+        pthread_t thread;
+        bool started;
+
+        /* readable when all workers stop, and to tell that one panicked */
+        int stop_fd;
+        int exit_fd;
+} Worker;
+
 typedef struct {
         VarlinkCall *call;
+        View *view;
 
-        struct sd_journal *journal;
-        char *cursor;
+        Reader *reader;
+        ReaderSubscription *subscription;
 
-        /* the epoll that contains the journal's fd */
-        int epoll_fd;
-} Monitor;
+        /* live entries are the ones written and read after this */
+        uint64_t start_realtime_usec;
+        uint64_t start_monotonic_usec;
 
-static const char *priorities[] = {
-        "debug",
-        "information",
-        "notice",
-        "warning",
-        "error",
-        "alert",
-        "critical",
-        "emergency"
-};
+        /* the latencies of this monitor's entries, if it asked for them */
+        Histogram *journal_latency;
+        Histogram *service_latency;
+} Monitor;
 
 static long exit_error(long error) {
         fprintf(stderr, "Error: %s\n", error_strings[error]);
@@ -62,69 +127,150 @@ static long epoll_add(int epoll_fd, int fd, void *ptr) {
         return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
 }
 
-static long journal_get_string(sd_journal *journal, const char *field, char **stringp) {
-        const void *data;
-        unsigned long field_length;
-        unsigned long length;
+/*
+ * Returns the reader for @filter. Monitors with the same filter share one,
+ * which reads only the matching entries. Returns -EBUSY if there are too
+ * many different filters, or the journal could not be opened for another.
+ */
+static long server_get_reader(Server *server, const Filter *filter, Reader **readerp) {
+        _cleanup_(reader_freep) Reader *reader = NULL;
         long r;
 
-        r = sd_journal_get_data(journal, field, &data, &length);
+        if (filter_is_empty(filter)) {
+                *readerp = server->reader;
+                return 0;
+        }
+
+        for (unsigned long i = 0; i < server->n_filter_readers; i += 1) {
+                if (filter_equal(reader_get_filter(server->filter_readers[i]), filter)) {
+                        *readerp = server->filter_readers[i];
+                        return 0;
+                }
+        }
+
+        if (server->n_filter_readers >= MAX_FILTER_READERS)
+                return -EBUSY;
+
+        /* without a ring, the initial lines are always read from the journal */
+        r = reader_new(&reader, server->feeds, filter, &server->default_fields, 0);
         if (r < 0)
-                return r;
+                return -EBUSY;
 
-        field_length = strlen(field) + 1; /* include the '=' */
+        if (epoll_add(server->epoll_fd, reader_get_fd(reader), reader) < 0)
+                return -EBUSY;
 
-        if (length < field_length)
-                return -EBADMSG;
+        server->filter_readers = realloc(server->filter_readers, (server->n_filter_readers + 1) * sizeof(Reader *));
+        server->filter_readers[server->n_filter_readers] = reader;
+        server->n_filter_readers += 1;
 
-        *stringp = strndup((char *)data + field_length, length - field_length);
+        *readerp = reader;
+        reader = NULL;
 
         return 0;
 }
 
-static long journal_get_int(sd_journal *journal, const char *field, int64_t *numberp) {
-        _cleanup_(freep) char *string = NULL;
-        char *end;
-        int64_t number;
+/* Frees the filter readers that no monitor uses anymore. */
+static void server_prune_readers(Server *server) {
+        unsigned long n_readers = 0;
+
+        for (unsigned long i = 0; i < server->n_filter_readers; i += 1) {
+                Reader *reader = server->filter_readers[i];
+
+                if (reader_has_subscriptions(reader)) {
+                        server->filter_readers[n_readers] = reader;
+                        n_readers += 1;
+                        continue;
+                }
+
+                epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, reader_get_fd(reader), NULL);
+                reader_free(reader);
+        }
+
+        server->n_filter_readers = n_readers;
+}
+
+/* Dispatches all readers, returns 1 if any of them has more to do. */
+static long server_dispatch_readers(Server *server) {
+        bool pending = false;
         long r;
 
-        r = journal_get_string(journal, field, &string);
+        r = reader_dispatch(server->reader);
         if (r < 0)
                 return r;
 
-        number = strtoll(string, &end, 10);
-        if (end == string)
-                return -EINVAL;
+        pending = r > 0;
 
-        *numberp = number;
+        for (unsigned long i = 0; i < server->n_filter_readers; i += 1) {
+                r = reader_dispatch(server->filter_readers[i]);
+                if (r < 0)
+                        return r;
 
-        return 0;
+                pending = pending || r > 0;
+        }
+
+        return pending;
 }
 
-static long format_time_rfc3339(uint64_t usec, char *string, unsigned long max) {
-        time_t time;
-        struct tm tm;
+/* Arms the timer for the first deadline of any reader. */
+static long server_arm_timer(Server *server) {
+        uint64_t deadline_usec = reader_get_deadline(server->reader);
+        struct itimerspec its = {};
 
-        time = usec / 1000000;
+        for (unsigned long i = 0; i < server->n_filter_readers; i += 1)
+                deadline_usec = MIN(deadline_usec, reader_get_deadline(server->filter_readers[i]));
 
-        if (!gmtime_r(&time, &tm))
-                return -EINVAL;
+        if (deadline_usec == server->timer_usec)
+                return 0;
 
-        strftime(string, max, "%Y-%m-%d %H:%M:%SZ", &tm);
+        /* a zero time disarms the timer */
+        if (deadline_usec != UINT64_MAX) {
+                its.it_value.tv_sec = deadline_usec / 1000000;
+                its.it_value.tv_nsec = (deadline_usec % 1000000) * 1000;
+        }
+
+        if (timerfd_settime(server->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+                return -errno;
+
+        server->timer_usec = deadline_usec;
 
         return 0;
 }
 
+static void server_deinit(Server *server) {
+        /* closes the connections, which frees their monitors */
+        if (server->service)
+                varlink_service_free(server->service);
+
+        for (unsigned long i = 0; i < server->n_filter_readers; i += 1)
+                reader_free(server->filter_readers[i]);
+
+        free(server->filter_readers);
+
+        if (server->reader)
+                reader_free(server->reader);
+
+        if (server->timer_fd >= 0)
+                close(server->timer_fd);
+
+        if (server->epoll_fd >= 0)
+                close(server->epoll_fd);
+
+        entry_fields_clear(&server->default_fields);
+}
 
 static void monitor_free(Monitor *monitor) {
-        if (monitor->journal) {
-                epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, sd_journal_get_fd(monitor->journal), NULL);
-                sd_journal_close(monitor->journal);
+        if (monitor->subscription) {
+                reader_unsubscribe(monitor->reader, monitor->subscription);
+                STATS_ADD(monitors, -1);
         }
 
+        if (monitor->view)
+                view_unref(monitor->view);
+
         varlink_call_unref(monitor->call);
-        free(monitor->cursor);
 
+        free(monitor->journal_latency);
+        free(monitor->service_latency);
         free(monitor);
 }
 
@@ -136,26 +282,29 @@ static void monitor_freep(Monitor **monitorp) {
 static void monitor_canceled(VarlinkCall *call, void *userdata) {
         Monitor *monitor = userdata;
 
+        PROBE(monitor_cancel, call);
+
         monitor_free(monitor);
 }
 
-static long monitor_new(Monitor **monitorp, VarlinkCall *call, int epoll_fd) {
+static long monitor_new(Monitor **monitorp,
+                        VarlinkCall *call,
+                        Server *server,
+                        const Filter *filter,
+                        const ViewOptions *view_options) {
         _cleanup_(monitor_freep) Monitor *monitor = NULL;
         long r;
 
         monitor = calloc(1, sizeof(Monitor));
-        monitor->epoll_fd = epoll_fd;
-
         monitor->call = varlink_call_ref(call);
+        monitor->start_realtime_usec = now(CLOCK_REALTIME);
+        monitor->start_monotonic_usec = now(CLOCK_MONOTONIC);
 
-        r = sd_journal_open(&monitor->journal, SD_JOURNAL_LOCAL_ONLY);
+        r = server_get_reader(server, filter, &monitor->reader);
         if (r < 0)
                 return r;
 
-        if (epoll_add(epoll_fd, sd_journal_get_fd(monitor->journal), monitor) < 0)
-                return -errno;
-
-        r = sd_journal_seek_tail(monitor->journal);
+        r = view_get(&server->views, view_options, &monitor->view);
         if (r < 0)
                 return r;
 
@@ -165,124 +314,316 @@ static long monitor_new(Monitor **monitorp, VarlinkCall *call, int epoll_fd) {
         return 0;
 }
 
-static long journal_read_next_entry(sd_journal *journal, VarlinkObject **entryp) {
-        _cleanup_(varlink_object_unrefp) VarlinkObject *entry = NULL;
-        _cleanup_(freep) char *cursor = NULL;
-        _cleanup_(freep) char *message = NULL;
-        _cleanup_(freep) char *process = NULL;
-        uint64_t usec;
-        char timestr[50];
-        int64_t priority = -1;
+static long reply_entries(VarlinkCall *call,
+                          View *view,
+                          Entry **entries,
+                          unsigned long n_entries,
+                          unsigned long n_dropped,
+                          const char *cursor,
+                          VarlinkObject *latency,
+                          uint64_t flags) {
+        _cleanup_(varlink_object_unrefp) VarlinkObject *reply = NULL;
+        uint64_t size = 0;
+        uint64_t start;
         long r;
 
-        r = sd_journal_next(journal);
-        if (r <= 0)
-                return r;
+        varlink_object_new(&reply);
+        varlink_object_set_array(reply, "entries", view_get_entries_array(view, entries, n_entries));
 
-        r = sd_journal_get_cursor(journal, &cursor);
-        if (r < 0)
-                return r;
+        if (n_dropped > 0)
+                varlink_object_set_int(reply, "dropped", n_dropped);
 
-        r = sd_journal_get_realtime_usec(journal, &usec);
-        if (r < 0)
-                return r;
+        if (cursor)
+                varlink_object_set_string(reply, "cursor", cursor);
 
-        r = format_time_rfc3339(usec, timestr, 50);
-        if (r < 0)
-                return r;
+        if (latency)
+                varlink_object_set_object(reply, "latency", latency);
 
-        r = journal_get_string(journal, "MESSAGE", &message);
-        if (r < 0)
+        start = profile_begin();
+        r = varlink_call_reply(call, reply, flags);
+        stats_profile(PROFILE_REPLY, start);
+        if (r < 0) {
+                STATS_ADD(failed_replies, 1);
                 return r;
+        }
 
-        r = journal_get_int(journal, "PRIORITY", &priority);
-        if (r < 0 && r != -ENOENT)
-                return r;
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                size += entries[i]->size;
 
-        varlink_object_new(&entry);
-        varlink_object_set_string(entry, "cursor", cursor);
-        varlink_object_set_string(entry, "time", timestr);
-        varlink_object_set_string(entry, "message", message);
+        STATS_ADD(replies, 1);
+        STATS_ADD(entries_sent, n_entries);
+        STATS_ADD(bytes_sent, size);
 
-        if (priority >= 0 && priority <= 7)
-                varlink_object_set_string(entry, "priority", priorities[priority]);
+        PROBE(batch_reply, call, n_entries, size, n_dropped, cursor);
 
-        if (journal_get_string(journal, "SYSLOG_IDENTIFIER", &process) == 0)
-                varlink_object_set_string(entry, "process", process);
-        else if (journal_get_string(journal, "_COMM", &process) == 0)
-                varlink_object_set_string(entry, "process", process);
+        return 0;
+}
 
-        *entryp = entry;
-        entry = NULL;
+static VarlinkObject *percentiles_new(const Histogram *histogram) {
+        VarlinkObject *percentiles;
 
-        return 1;
+        varlink_object_new(&percentiles);
+        varlink_object_set_int(percentiles, "count", histogram_get_count(histogram));
+        varlink_object_set_int(percentiles, "p50_usec", histogram_get_percentile(histogram, 0.5));
+        varlink_object_set_int(percentiles, "p99_usec", histogram_get_percentile(histogram, 0.99));
+        varlink_object_set_int(percentiles, "p999_usec", histogram_get_percentile(histogram, 0.999));
+        varlink_object_set_int(percentiles, "max_usec", histogram_get_percentile(histogram, 1));
+
+        return percentiles;
+}
+
+static VarlinkObject *latency_new(const Histogram *journal_latency, const Histogram *service_latency) {
+        _cleanup_(varlink_object_unrefp) VarlinkObject *journal = percentiles_new(journal_latency);
+        _cleanup_(varlink_object_unrefp) VarlinkObject *service = percentiles_new(service_latency);
+        VarlinkObject *latency;
+
+        varlink_object_new(&latency);
+        varlink_object_set_object(latency, "journal", journal);
+        varlink_object_set_object(latency, "service", service);
+
+        return latency;
+}
+
+/*
+ * Counts how long the live ones of @entries took from being written to the
+ * journal and from being read by a feed until now, when they are handed to
+ * libvarlink. It sends them right away unless the client's socket is full.
+ */
+static void monitor_record_latency(Monitor *monitor, Entry **entries, unsigned long n_entries) {
+        uint64_t realtime_usec = now(CLOCK_REALTIME);
+        uint64_t monotonic_usec = now(CLOCK_MONOTONIC);
+
+        for (unsigned long i = 0; i < n_entries; i += 1) {
+                Entry *entry = entries[i];
+
+                /* the clock may have been set back since */
+                if (entry->realtime_usec >= monitor->start_realtime_usec && entry->realtime_usec <= realtime_usec) {
+                        uint64_t usec = realtime_usec - entry->realtime_usec;
+
+                        STATS_RECORD(journal_latency, usec);
+                        if (monitor->journal_latency)
+                                histogram_add(monitor->journal_latency, usec);
+                }
+
+                if (entry->arrival_usec >= monitor->start_monotonic_usec) {
+                        uint64_t usec = monotonic_usec - entry->arrival_usec;
+
+                        STATS_RECORD(service_latency, usec);
+                        if (monitor->service_latency)
+                                histogram_add(monitor->service_latency, usec);
+                }
+        }
 }
 
-static long monitor_read_entries(Monitor *monitor, VarlinkArray **entriesp) {
-        _cleanup_(varlink_array_unrefp) VarlinkArray *entries = NULL;
-        long n_read = 0;
+static long monitor_dispatch(Entry **entries,
+                             unsigned long n_entries,
+                             unsigned long n_dropped,
+                             const char *cursor,
+                             void *userdata) {
+        Monitor *monitor = userdata;
+        _cleanup_(varlink_object_unrefp) VarlinkObject *latency = NULL;
         long r;
 
-        varlink_array_new(&entries);
+        monitor_record_latency(monitor, entries, n_entries);
 
-        for (;;) {
-                _cleanup_(varlink_object_unrefp) VarlinkObject *entry = NULL;
+        if (monitor->journal_latency)
+                latency = latency_new(monitor->journal_latency, monitor->service_latency);
 
-                r = journal_read_next_entry(monitor->journal, &entry);
-                if (r < 0)
-                        return -VARLINK_ERROR_PANIC;
+        r = reply_entries(monitor->call,
+                          monitor->view,
+                          entries,
+                          n_entries,
+                          n_dropped,
+                          cursor,
+                          latency,
+                          VARLINK_REPLY_CONTINUES);
+        if (r < 0 && isatty(STDERR_FILENO))
+                fprintf(stderr, "Error dispatching message: %s\n", varlink_error_string(-r));
 
-                if (r == 0)
-                        break;
+        return r;
+}
+
+/* The socket of @call, which tells how much of the replies were read. */
+static int call_get_fd(VarlinkCall *call) {
+#if HAVE_VARLINK_CALL_GET_CONNECTION_FD
+        return varlink_call_get_connection_fd(call);
+#else
+        return -1;
+#endif
+}
+
+/*
+ * Parses the list of requested fields. The names of the Entry type map to
+ * the fields the service decodes itself, anything else is a journal field.
+ */
+static long parse_fields_array(VarlinkArray *array, EntryFields *fields) {
+        static const struct {
+                const char *name;
+                unsigned int mask;
+        } names[] = {
+                { "cursor", ENTRY_FIELD_CURSOR },
+                { "message", ENTRY_FIELD_MESSAGE },
+                { "priority", ENTRY_FIELD_PRIORITY },
+                { "process", ENTRY_FIELD_PROCESS },
+                { "pid", ENTRY_FIELD_PID },
+                { "uid", ENTRY_FIELD_UID }
+        };
+
+        for (unsigned long i = 0; i < varlink_array_get_n_elements(array); i += 1) {
+                const char *name;
+                unsigned long k;
+
+                if (varlink_array_get_string(array, i, &name) < 0)
+                        return -EINVAL;
 
-                varlink_array_append_object(entries, entry);
-                n_read += 1;
+                for (k = 0; k < ARRAY_SIZE(names); k += 1) {
+                        if (strcmp(name, names[k].name) == 0) {
+                                fields->mask |= names[k].mask;
+                                break;
+                        }
+                }
+
+                if (k < ARRAY_SIZE(names))
+                        continue;
+
+                if (!journal_field_name_is_valid(name))
+                        return -EINVAL;
+
+                entry_fields_add_extra(fields, name);
         }
 
-        free(monitor->cursor);
-        monitor->cursor = NULL;
+        return 0;
+}
 
-        if (n_read > 0) {
-                r = sd_journal_get_cursor(monitor->journal, &monitor->cursor);
-                if (r < 0)
-                        return -VARLINK_ERROR_PANIC;
+/*
+ * Parses the match parameters into @filter: every group of @matches is
+ * narrowed by the other parameters, the journal would take matches of
+ * both on a field as alternatives. Groups that contradict them are left
+ * out. Returns the name of an invalid parameter in @parameterp.
+ */
+static long parse_filter(VarlinkObject *parameters, Filter *filter, const char **parameterp) {
+        _cleanup_(filter_term_clear) FilterTerm base = {};
+        int64_t priority;
+        const char *string;
+        VarlinkArray *matches;
+        VarlinkArray *patterns;
+
+        if (varlink_object_get_int(parameters, "priority", &priority) >= 0) {
+                if (priority < 0 || priority > 7) {
+                        *parameterp = "priority";
+                        return -EINVAL;
+                }
+
+                for (int64_t i = 0; i <= priority; i += 1) {
+                        char value[2] = { '0' + i, '\0' };
+
+                        filter_term_add_field_match(&base, "PRIORITY", value);
+                }
         }
 
-        *entriesp = entries;
-        entries = NULL;
+        if (varlink_object_get_string(parameters, "unit", &string) >= 0)
+                filter_term_add_field_match(&base, "_SYSTEMD_UNIT", string);
 
-        return n_read;
-}
+        if (varlink_object_get_string(parameters, "syslog_identifier", &string) >= 0)
+                filter_term_add_field_match(&base, "SYSLOG_IDENTIFIER", string);
 
-static long monitor_dispatch(Monitor *monitor) {
-        _cleanup_(varlink_array_unrefp) VarlinkArray *entries = NULL;
-        _cleanup_(varlink_object_unrefp) VarlinkObject *reply = NULL;
-        int event;
-        long r;
+        if (varlink_object_get_string(parameters, "boot_id", &string) >= 0) {
+                sd_id128_t boot_id;
+                char boot_id_string[33];
 
-        event = sd_journal_process(monitor->journal);
-        if (event == SD_JOURNAL_INVALIDATE) {
-                if (monitor->cursor)
-                        r = sd_journal_seek_cursor(monitor->journal, monitor->cursor);
-                else
-                        r = sd_journal_seek_tail(monitor->journal);
-                if (r < 0)
-                        return -VARLINK_ERROR_PANIC;
+                if (sd_id128_from_string(string, &boot_id) < 0) {
+                        *parameterp = "boot_id";
+                        return -EINVAL;
+                }
 
-        } else if (event != SD_JOURNAL_APPEND)
-                return 0;
+                filter_term_add_field_match(&base, "_BOOT_ID", sd_id128_to_string(boot_id, boot_id_string));
+        }
 
-        r = monitor_read_entries(monitor, &entries);
-        if (r < 0)
-                return r;
+        if (varlink_object_get_array(parameters, "message_contains", &patterns) >= 0) {
+                unsigned long length = 0;
+
+                for (unsigned long i = 0; i < varlink_array_get_n_elements(patterns); i += 1) {
+                        if (varlink_array_get_string(patterns, i, &string) < 0 || string[0] == '\0') {
+                                *parameterp = "message_contains";
+                                return -EINVAL;
+                        }
+
+                        length += strlen(string);
+                        filter_add_pattern(filter, string);
+                }
 
-        if (r == 0)
+                if (length > GREP_PATTERNS_MAX_LENGTH) {
+                        *parameterp = "message_contains";
+                        return -EINVAL;
+                }
+        }
+
+        if (varlink_object_get_array(parameters, "matches", &matches) < 0 ||
+            varlink_array_get_n_elements(matches) == 0) {
+                filter_add_term(filter, &base);
                 return 0;
+        }
 
-        varlink_object_new(&reply);
-        varlink_object_set_array(reply, "entries", entries);
+        for (unsigned long i = 0; i < varlink_array_get_n_elements(matches); i += 1) {
+                _cleanup_(filter_term_clear) FilterTerm term = {};
+                VarlinkArray *group;
 
-        return varlink_call_reply(monitor->call, reply, VARLINK_REPLY_CONTINUES);
+                *parameterp = "matches";
+
+                if (varlink_array_get_array(matches, i, &group) < 0 ||
+                    varlink_array_get_n_elements(group) == 0)
+                        return -EINVAL;
+
+                for (unsigned long k = 0; k < varlink_array_get_n_elements(group); k += 1) {
+                        if (varlink_array_get_string(group, k, &string) < 0 ||
+                            !journal_match_is_valid(string))
+                                return -EINVAL;
+
+                        filter_term_add_match(&term, string);
+                }
+
+                if (filter_term_intersect(&term, &base))
+                        filter_add_term(filter, &term);
+        }
+
+        /* no entry can match, but an empty filter would match all of them */
+        if (filter->n_terms == 0)
+                return -EINVAL;
+
+        return 0;
+}
+
+/*
+ * Parses @fields, @entry_cursors and @max_message_bytes into @fields, which
+ * has the defaults. Returns the name of an invalid parameter in @parameterp.
+ */
+static long parse_fields(VarlinkObject *parameters, EntryFields *fields, const char **parameterp) {
+        VarlinkArray *array;
+        bool entry_cursors = false;
+        int64_t max_message_bytes;
+
+        if (varlink_object_get_array(parameters, "fields", &array) >= 0) {
+                fields->mask = 0;
+                if (parse_fields_array(array, fields) < 0) {
+                        *parameterp = "fields";
+                        return -EINVAL;
+                }
+        }
+
+        varlink_object_get_bool(parameters, "entry_cursors", &entry_cursors);
+        if (entry_cursors)
+                fields->mask |= ENTRY_FIELD_CURSOR;
+
+        if (varlink_object_get_int(parameters, "max_message_bytes", &max_message_bytes) >= 0) {
+                if (max_message_bytes < 0) {
+                        *parameterp = "max_message_bytes";
+                        return -EINVAL;
+                }
+
+                fields->max_message_bytes = max_message_bytes;
+        }
+
+        return 0;
 }
 
 static long com_redhat_logging_monitor(VarlinkService *service,
@@ -290,42 +631,254 @@ static long com_redhat_logging_monitor(VarlinkService *service,
                                        VarlinkObject *parameters,
                                        uint64_t flags,
                                        void *userdata) {
-        int epoll_fd = (int)(unsigned long)userdata;
+        Server *server = userdata;
         _cleanup_(monitor_freep) Monitor *monitor = NULL;
-        _cleanup_(varlink_object_unrefp) VarlinkObject *reply = NULL;
-        _cleanup_(varlink_array_unrefp) VarlinkArray *entries = NULL;
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
         int64_t initial_lines = 10;
+        int64_t max_entries_per_reply = server->max_entries_per_reply;
+        int64_t max_pending_entries = server->max_pending_entries;
+        int64_t max_pending_bytes = server->max_pending_bytes;
+        const char *on_overflow = "pause";
+        const char *delivery = "latency";
+        _cleanup_(entry_fields_clear) EntryFields fields = {
+                .mask = ENTRY_FIELDS_DEFAULT,
+                .max_message_bytes = server->max_message_bytes
+        };
+        _cleanup_(filter_clear) Filter filter = {};
+        const char *invalid_parameter;
+        bool numeric_time = false;
+        bool latency = false;
+        const char *invalid_utf8 = "replace";
+        InvalidUtf8Policy invalid_utf8_policy;
+        ViewOptions view_options;
+        ReaderOptions options;
         long r;
 
-        r = monitor_new(&monitor, call, epoll_fd);
-        if (r < 0)
-                return r;
-
         varlink_object_get_int(parameters, "initial_lines", &initial_lines);
         if (initial_lines < 0)
                 return varlink_call_reply_invalid_parameter(call, "initial_lines");
 
-        r = sd_journal_previous_skip(monitor->journal, initial_lines + 1);
+        varlink_object_get_int(parameters, "max_entries_per_reply", &max_entries_per_reply);
+        if (max_entries_per_reply <= 0)
+                return varlink_call_reply_invalid_parameter(call, "max_entries_per_reply");
+
+        varlink_object_get_int(parameters, "max_pending_entries", &max_pending_entries);
+        if (max_pending_entries <= 0)
+                return varlink_call_reply_invalid_parameter(call, "max_pending_entries");
+
+        varlink_object_get_int(parameters, "max_pending_bytes", &max_pending_bytes);
+        if (max_pending_bytes <= 0)
+                return varlink_call_reply_invalid_parameter(call, "max_pending_bytes");
+
+        varlink_object_get_string(parameters, "on_overflow", &on_overflow);
+        if (strcmp(on_overflow, "pause") != 0 && strcmp(on_overflow, "drop") != 0)
+                return varlink_call_reply_invalid_parameter(call, "on_overflow");
+
+        varlink_object_get_string(parameters, "delivery", &delivery);
+        if (strcmp(delivery, "latency") != 0 && strcmp(delivery, "throughput") != 0)
+                return varlink_call_reply_invalid_parameter(call, "delivery");
+
+        if (parse_fields(parameters, &fields, &invalid_parameter) < 0)
+                return varlink_call_reply_invalid_parameter(call, invalid_parameter);
+
+        varlink_object_get_bool(parameters, "numeric_time", &numeric_time);
+        varlink_object_get_bool(parameters, "latency", &latency);
+
+        varlink_object_get_string(parameters, "invalid_utf8", &invalid_utf8);
+        if (invalid_utf8_policy_from_string(invalid_utf8, &invalid_utf8_policy) < 0)
+                return varlink_call_reply_invalid_parameter(call, "invalid_utf8");
+
+        if (parse_filter(parameters, &filter, &invalid_parameter) < 0)
+                return varlink_call_reply_invalid_parameter(call, invalid_parameter);
+
+        view_options = (ViewOptions) {
+                .fields = fields,
+                .numeric_time = numeric_time,
+                .time_precision = server->time_precision,
+                .invalid_utf8 = invalid_utf8_policy
+        };
+
+        options = (ReaderOptions) {
+                .max_entries = MIN((unsigned long)max_entries_per_reply, server->max_entries_per_reply),
+                .max_pending_entries = MIN((unsigned long)max_pending_entries, server->max_pending_entries),
+                .max_pending_bytes = MIN((unsigned long)max_pending_bytes, server->max_pending_bytes),
+                .fd = call_get_fd(call),
+                .drop = strcmp(on_overflow, "drop") == 0,
+                .fields = fields,
+                .max_delay_usec = strcmp(delivery, "throughput") == 0 ? server->max_delay_usec : 0
+        };
+
+        r = monitor_new(&monitor, call, server, &filter, &view_options);
+        if (r == -EBUSY)
+                return varlink_call_reply_error(call, "com.redhat.logging.TooManyFilters", NULL);
+        if (r < 0)
+                return r;
+
+        if (latency) {
+                monitor->journal_latency = calloc(1, sizeof(Histogram));
+                monitor->service_latency = calloc(1, sizeof(Histogram));
+        }
+
+        /* a single reply, which is no larger than any other */
+        if (!(flags & VARLINK_CALL_MORE)) {
+                r = reader_read_backlog(monitor->reader,
+                                        MIN((unsigned long)initial_lines, options.max_entries),
+                                        &fields,
+                                        &entries,
+                                        &n_entries);
+                if (r < 0)
+                        return r;
+
+                r = reply_entries(call, monitor->view, entries, n_entries, 0, reader_get_cursor(monitor->reader), NULL, 0);
+                entry_array_free(entries, n_entries);
+
+                return r;
+        }
+
+        /* delivers the first reply */
+        r = reader_subscribe(monitor->reader,
+                             initial_lines,
+                             &options,
+                             monitor_dispatch,
+                             monitor,
+                             &monitor->subscription);
         if (r < 0)
                 return r;
 
-        r = monitor_read_entries(monitor, &entries);
+        STATS_ADD(monitors, 1);
+        PROBE(monitor_new, call, initial_lines, max_entries_per_reply);
+
+        varlink_call_set_connection_closed_callback(call, monitor_canceled, monitor);
+        monitor = NULL;
+
+        return 0;
+}
+
+static long com_redhat_logging_query(VarlinkService *service,
+                                     VarlinkCall *call,
+                                     VarlinkObject *parameters,
+                                     uint64_t flags,
+                                     void *userdata) {
+        Server *server = userdata;
+        _cleanup_(view_unrefp) View *view = NULL;
+        Reader *reader;
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        _cleanup_(freep) char *cursor = NULL;
+        int64_t since_usec = 0;
+        int64_t until_usec = INT64_MAX;
+        int64_t limit = server->max_entries_per_reply;
+        const char *direction = "forward";
+        _cleanup_(entry_fields_clear) EntryFields fields = {
+                .mask = ENTRY_FIELDS_DEFAULT,
+                .max_message_bytes = server->max_message_bytes
+        };
+        _cleanup_(filter_clear) Filter filter = {};
+        const char *invalid_parameter;
+        bool numeric_time = false;
+        const char *invalid_utf8 = "replace";
+        InvalidUtf8Policy invalid_utf8_policy;
+        ViewOptions view_options;
+        ReaderQuery query = {};
+        long r;
+
+        varlink_object_get_int(parameters, "since_usec", &since_usec);
+        if (since_usec < 0)
+                return varlink_call_reply_invalid_parameter(call, "since_usec");
+
+        varlink_object_get_int(parameters, "until_usec", &until_usec);
+        if (until_usec < since_usec)
+                return varlink_call_reply_invalid_parameter(call, "until_usec");
+
+        varlink_object_get_string(parameters, "after", &query.after);
+        varlink_object_get_string(parameters, "before", &query.before);
+
+        /* a page is one reply */
+        varlink_object_get_int(parameters, "limit", &limit);
+        if (limit <= 0)
+                return varlink_call_reply_invalid_parameter(call, "limit");
+
+        varlink_object_get_string(parameters, "direction", &direction);
+        if (strcmp(direction, "forward") != 0 && strcmp(direction, "backward") != 0)
+                return varlink_call_reply_invalid_parameter(call, "direction");
+
+        if (parse_fields(parameters, &fields, &invalid_parameter) < 0)
+                return varlink_call_reply_invalid_parameter(call, invalid_parameter);
+
+        varlink_object_get_bool(parameters, "numeric_time", &numeric_time);
+
+        varlink_object_get_string(parameters, "invalid_utf8", &invalid_utf8);
+        if (invalid_utf8_policy_from_string(invalid_utf8, &invalid_utf8_policy) < 0)
+                return varlink_call_reply_invalid_parameter(call, "invalid_utf8");
+
+        if (parse_filter(parameters, &filter, &invalid_parameter) < 0)
+                return varlink_call_reply_invalid_parameter(call, invalid_parameter);
+
+        query.since_usec = since_usec;
+        query.until_usec = until_usec == INT64_MAX ? UINT64_MAX : (uint64_t)until_usec;
+        query.limit = MIN((unsigned long)limit, server->max_entries_per_reply);
+        query.backward = strcmp(direction, "backward") == 0;
+
+        view_options = (ViewOptions) {
+                .fields = fields,
+                .numeric_time = numeric_time,
+                .time_precision = server->time_precision,
+                .invalid_utf8 = invalid_utf8_policy
+        };
+
+        r = view_get(&server->views, &view_options, &view);
         if (r < 0)
                 return r;
 
-        varlink_object_new(&reply);
-        varlink_object_set_array(reply, "entries", entries);
+        /* a reader that was only created for this query is freed in the main loop */
+        r = server_get_reader(server, &filter, &reader);
+        if (r == -EBUSY)
+                return varlink_call_reply_error(call, "com.redhat.logging.TooManyFilters", NULL);
+        if (r < 0)
+                return r;
 
-        r = varlink_call_reply(call, reply, flags & VARLINK_CALL_MORE ? VARLINK_REPLY_CONTINUES : 0);
+        r = reader_query(reader, &query, &fields, &entries, &n_entries, &cursor);
         if (r < 0)
                 return r;
 
-        if (flags & VARLINK_CALL_MORE) {
-                varlink_call_set_connection_closed_callback(call, monitor_canceled, monitor);
-                monitor = NULL;
-        }
+        r = reply_entries(call, view, entries, n_entries, 0, cursor, NULL, 0);
+        entry_array_free(entries, n_entries);
 
-        return 0;
+        return r;
+}
+
+static long com_redhat_logging_get_statistics(VarlinkService *service,
+                                              VarlinkCall *call,
+                                              VarlinkObject *parameters,
+                                              uint64_t flags,
+                                              void *userdata) {
+        _cleanup_(varlink_object_unrefp) VarlinkObject *reply = NULL;
+        _cleanup_(varlink_object_unrefp) VarlinkObject *latency = NULL;
+        Stats stats;
+
+        /* the threads keep counting while they are summed up */
+        stats_sum(&stats);
+
+        varlink_object_new(&reply);
+        varlink_object_set_int(reply, "entries_read", stats.entries_read);
+        varlink_object_set_int(reply, "bytes_read", stats.bytes_read);
+        varlink_object_set_int(reply, "replies", stats.replies);
+        varlink_object_set_int(reply, "entries_sent", stats.entries_sent);
+        varlink_object_set_int(reply, "bytes_sent", stats.bytes_sent);
+        varlink_object_set_int(reply, "failed_replies", stats.failed_replies);
+        varlink_object_set_int(reply, "entries_dropped", stats.entries_dropped);
+        varlink_object_set_int(reply, "iterations", stats.iterations);
+        varlink_object_set_int(reply, "dispatches", stats.dispatches);
+        varlink_object_set_int(reply, "dispatch_usec", stats.dispatch_usec);
+        varlink_object_set_int(reply, "monitors", stats.monitors);
+        varlink_object_set_int(reply, "lagging_monitors", stats.lagging_monitors);
+        varlink_object_set_int(reply, "buffered_bytes", stats.buffered_bytes);
+
+        latency = latency_new(&stats.journal_latency, &stats.service_latency);
+        varlink_object_set_object(reply, "latency", latency);
+
+        return varlink_call_reply(call, reply, 0);
 }
 
 static int make_signalfd(void) {
@@ -334,6 +887,7 @@ static int make_signalfd(void) {
         sigemptyset(&mask);
         sigaddset(&mask, SIGTERM);
         sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGUSR1);
         sigprocmask(SIG_BLOCK, &mask, NULL);
 
         return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
@@ -350,27 +904,253 @@ static long read_signal(int signal_fd) {
         return fdsi.ssi_signo;
 }
 
+/*
+ * Sets up a worker that accepts connections on @listen_fd. The settings of
+ * @server are already set.
+ */
+static long server_init(Server *server, const char *address, int listen_fd, unsigned long ring_size) {
+        long r;
+
+        server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (server->epoll_fd < 0)
+                return -errno;
+
+        server->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (server->timer_fd < 0)
+                return -errno;
+
+        server->timer_usec = UINT64_MAX;
+
+        /* the service closes its copy */
+        listen_fd = fcntl(listen_fd, F_DUPFD_CLOEXEC, 3);
+        if (listen_fd < 0)
+                return -errno;
+
+        r = varlink_service_new(&server->service,
+                                "Red Hat",
+                                "Logging Interface",
+                                VERSION,
+                                "https://github.com/varlink/com.redhat.logging",
+                                address,
+                                listen_fd);
+        if (r < 0) {
+                close(listen_fd);
+                return r;
+        }
+
+        r = reader_new(&server->reader, server->feeds, NULL, &server->default_fields, ring_size);
+        if (r < 0)
+                return r;
+
+        if (epoll_add(server->epoll_fd, varlink_service_get_fd(server->service), server->service) < 0 ||
+            epoll_add(server->epoll_fd, reader_get_fd(server->reader), server->reader) < 0 ||
+            epoll_add(server->epoll_fd, server->timer_fd, &server->timer_fd) < 0)
+                return -errno;
+
+        return varlink_service_add_interface(server->service, com_redhat_logging_varlink,
+                                             "Monitor", com_redhat_logging_monitor, server,
+                                             "Query", com_redhat_logging_query, server,
+                                             "GetStatistics", com_redhat_logging_get_statistics, server,
+                                             NULL);
+}
+
+static bool fd_is_readable(int fd) {
+        struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+
+        return poll(&pollfd, 1, 0) > 0;
+}
+
+/*
+ * Handles the events of the connections, at most MAX_SERVICE_EVENTS of
+ * them, so that the monitors get their entries in between.
+ */
+static long server_process_service(Server *server) {
+        long r;
+
+        for (unsigned long i = 0; i < MAX_SERVICE_EVENTS; i += 1) {
+                /* the workers race for new connections, the others fail to accept */
+                r = varlink_service_process_events(server->service);
+                switch (r) {
+                        case 0:
+                                break;
+
+                        case -VARLINK_ERROR_PANIC:
+                                return r;
+
+                        default:
+                                if (isatty(STDERR_FILENO))
+                                        fprintf(stderr, "Error processing event: %s\n", varlink_error_string(-r));
+                }
+
+                if (!fd_is_readable(varlink_service_get_fd(server->service)))
+                        break;
+        }
+
+        return 0;
+}
+
+/* Runs the event loop of a worker until @stop_fd becomes readable. */
+static long server_run(Server *server, int stop_fd) {
+        bool reader_pending = false;
+        long r;
+
+        if (epoll_add(server->epoll_fd, stop_fd, NULL) < 0)
+                return ERROR_PANIC;
+
+        for (;;) {
+                struct epoll_event events[MAX_EVENTS];
+                bool service_ready = false;
+                uint64_t start_usec;
+                uint64_t start;
+                int n;
+
+                /* do not sleep while the reader has entries left to send */
+                n = epoll_wait(server->epoll_fd, events, MAX_EVENTS, reader_pending ? 0 : -1);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return ERROR_PANIC;
+                }
+
+                /* without events, continue with the pending entries */
+                for (int i = 0; i < n; i += 1) {
+                        if (events[i].data.ptr == server->service)
+                                service_ready = true;
+
+                        else if (events[i].data.ptr == NULL)
+                                return 0;
+
+                        /* expired entries are flushed by the dispatch below */
+                        else if (events[i].data.ptr == &server->timer_fd) {
+                                uint64_t n_expirations;
+
+                                if (read(server->timer_fd, &n_expirations, sizeof(n_expirations)) < 0 && errno != EAGAIN)
+                                        return ERROR_PANIC;
+                        }
+
+                        else if (reader_process(events[i].data.ptr) < 0)
+                                return ERROR_PANIC;
+                }
+
+                if (service_ready && server_process_service(server) < 0)
+                        return ERROR_PANIC;
+
+                /* one bounded batch per iteration, new monitors included */
+                start_usec = now(CLOCK_MONOTONIC);
+                start = profile_begin();
+                r = server_dispatch_readers(server);
+                if (r < 0)
+                        return ERROR_PANIC;
+
+                stats_profile(PROFILE_DISPATCH, start);
+
+                STATS_ADD(iterations, 1);
+                STATS_ADD(dispatches, 1 + server->n_filter_readers);
+                STATS_ADD(dispatch_usec, now(CLOCK_MONOTONIC) - start_usec);
+
+                reader_pending = r > 0;
+
+                server_prune_readers(server);
+
+                if (server_arm_timer(server) < 0)
+                        return ERROR_PANIC;
+        }
+}
+
+static void *worker_run(void *userdata) {
+        Worker *worker = userdata;
+
+        stats_thread_start();
+
+        if (server_run(&worker->server, worker->stop_fd) != 0)
+                eventfd_write(worker->exit_fd, 1);
+
+        stats_thread_stop();
+
+        return NULL;
+}
+
+static void print_profile(void) {
+        Stats stats;
+
+        stats_sum(&stats);
+        profile_print(&stats.profile, stderr);
+}
+
+static int make_listen_fd(const char *address, char **pathp) {
+        int fd;
+        int flags;
+
+        /* An activator passed us our listen socket. */
+        if (read(3, NULL, 0) == 0)
+                fd = 3;
+        else
+                fd = varlink_listen(address, pathp);
+
+        if (fd < 0)
+                return fd;
+
+        /* all workers are woken by a new connection, the ones losing the
+         * race must not block in accept(); the flag is shared by all dups */
+        flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+                close(fd);
+                return -errno;
+        }
+
+        return fd;
+}
+
 int main(int argc, char **argv) {
-        _cleanup_(varlink_service_freep) VarlinkService *service = NULL;
-        _cleanup_(closep) int epoll_fd = -1;
+        _cleanup_(feed_set_freep) FeedSet *feeds = NULL;
+        _cleanup_(freep) Worker *workers = NULL;
+        _cleanup_(closep) int listen_fd = -1;
         _cleanup_(closep) int signal_fd = -1;
+        _cleanup_(closep) int stop_fd = -1;
+        _cleanup_(closep) int exit_fd = -1;
+        _cleanup_(freep) char *path = NULL;
         static const struct option options[] = {
-                { "varlink", required_argument, NULL, 'v' },
-                { "help",    no_argument,       NULL, 'h' },
+                { "varlink",               required_argument, NULL, 'v' },
+                { "ring-size",             required_argument, NULL, 'r' },
+                { "max-entries-per-reply", required_argument, NULL, 'm' },
+                { "time-precision",        required_argument, NULL, 't' },
+                { "max-message-bytes",     required_argument, NULL, 'b' },
+                { "workers",               required_argument, NULL, 'w' },
+                { "max-delay-ms",          required_argument, NULL, 'd' },
+                { "profile",               no_argument,       NULL, 'p' },
+                { "help",                  no_argument,       NULL, 'h' },
                 {}
         };
         int c;
         const char *address = NULL;
-        int fd = -1;
+        unsigned long ring_size = 1000;
+        unsigned long max_entries_per_reply = 500;
+        unsigned long max_message_bytes = 64 * 1024;
+        TimePrecision time_precision = TIME_PRECISION_SECONDS;
+        unsigned long n_workers = 1;
+        unsigned long max_delay_ms = 50;
+        struct pollfd fds[2];
+        long error = 0;
         long r;
 
-        while ((c = getopt_long(argc, argv, ":vh", options, NULL)) >= 0) {
+        while ((c = getopt_long(argc, argv, ":vr:m:t:b:w:d:ph", options, NULL)) >= 0) {
                 switch (c) {
                         case 'h':
                                 printf("Usage: %s ADDRESS\n", program_invocation_short_name);
                                 printf("\n");
                                 printf("Provide a varlink service that exposes the system log on ADDRESS\n");
                                 printf("\n");
+                                printf("Options:\n");
+                                printf("  --ring-size=N              keep the N most recent entries in memory (default: 1000)\n");
+                                printf("  --max-entries-per-reply=N  send at most N entries per reply (default: 500)\n");
+                                printf("  --time-precision=s|ms|us   precision of the entries' times (default: s)\n");
+                                printf("  --max-message-bytes=N      cut messages after N bytes, 0 for no limit (default: 65536)\n");
+                                printf("  --workers=N                serve connections from N threads (default: 1)\n");
+                                printf("  --max-delay-ms=N           hold new entries for throughput monitors up to N ms (default: 50)\n");
+                                printf("  --profile                  time the phases of reading and sending entries, print\n");
+                                printf("                             them on SIGUSR1 and at exit\n");
+                                printf("\n");
                                 printf("Return values:\n");
                                 for (unsigned long i = 1; i < ERROR_MAX; i += 1)
                                         printf(" %3lu %s\n", i, error_strings[i]);
@@ -378,98 +1158,160 @@ int main(int argc, char **argv) {
 
                         case 'v':
                                 address = optarg;
+                                break;
+
+                        case 'r':
+                                if (parse_unsigned(optarg, &ring_size) < 0)
+                                        return exit_error(ERROR_INVALID_ARGUMENT);
+                                break;
+
+                        case 'm':
+                                if (parse_unsigned(optarg, &max_entries_per_reply) < 0 ||
+                                    max_entries_per_reply == 0)
+                                        return exit_error(ERROR_INVALID_ARGUMENT);
+                                break;
+
+                        case 't':
+                                if (time_precision_from_string(optarg, &time_precision) < 0)
+                                        return exit_error(ERROR_INVALID_ARGUMENT);
+                                break;
+
+                        case 'b':
+                                if (parse_unsigned(optarg, &max_message_bytes) < 0)
+                                        return exit_error(ERROR_INVALID_ARGUMENT);
+                                break;
+
+                        case 'w':
+                                if (parse_unsigned(optarg, &n_workers) < 0 ||
+                                    n_workers == 0 || n_workers > 1024)
+                                        return exit_error(ERROR_INVALID_ARGUMENT);
+                                break;
+
+                        case 'd':
+                                if (parse_unsigned(optarg, &max_delay_ms) < 0 || max_delay_ms > 60 * 1000)
+                                        return exit_error(ERROR_INVALID_ARGUMENT);
+                                break;
+
+                        case 'p':
+                                profile_enabled = true;
+                                break;
                 }
         }
 
         if (!address)
                 return exit_error(ERROR_MISSING_ADDRESS);
 
-        /* An activator passed us our listen socket. */
-        if (read(3, NULL, 0) == 0)
-                fd = 3;
+        /* the rings are filled and freed in this thread */
+        stats_thread_start();
 
-        r = varlink_service_new(&service,
-                                "Red Hat",
-                                "Logging Interface",
-                                VERSION,
-                                "https://github.com/varlink/com.redhat.logging",
-                                address,
-                                fd);
-        if (r < 0)
+        listen_fd = make_listen_fd(address, &path);
+        if (listen_fd < 0)
                 return exit_error(ERROR_PANIC);
 
+        /* blocked in all threads */
         signal_fd = make_signalfd();
         if (signal_fd < 0)
                 return exit_error(ERROR_PANIC);
 
-        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-        if (epoll_fd < 0 ||
-            epoll_add(epoll_fd, varlink_service_get_fd(service), service) < 0 ||
-            epoll_add(epoll_fd, signal_fd, NULL) < 0)
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        exit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (stop_fd < 0 || exit_fd < 0)
                 return exit_error(ERROR_PANIC);
 
-        r = varlink_service_add_interface(service, com_redhat_logging_varlink,
-                                          "Monitor", com_redhat_logging_monitor, (void *)(unsigned long)epoll_fd,
-                                          NULL);
-        if (r < 0)
-                return exit_error(ERROR_PANIC);
+        feed_set_new(&feeds, max_entries_per_reply, MAX_FEED_BATCHES);
 
-        for (;;) {
-                struct epoll_event event;
-                int n;
+        workers = calloc(n_workers, sizeof(Worker));
 
-                n = epoll_wait(epoll_fd, &event, 1, -1);
-                if (n < 0) {
+        for (unsigned long i = 0; i < n_workers; i += 1) {
+                Server *server = &workers[i].server;
+
+                workers[i].stop_fd = stop_fd;
+                workers[i].exit_fd = exit_fd;
+
+                server->epoll_fd = -1;
+                server->timer_fd = -1;
+                server->feeds = feeds;
+                server->max_entries_per_reply = max_entries_per_reply;
+                server->max_pending_entries = 10000;
+                server->max_pending_bytes = 4 * 1024 * 1024;
+                server->max_message_bytes = max_message_bytes;
+                server->max_delay_usec = max_delay_ms * 1000;
+                server->time_precision = time_precision;
+                server->default_fields = (EntryFields) {
+                        .mask = ENTRY_FIELDS_DEFAULT,
+                        .max_message_bytes = max_message_bytes
+                };
+
+                if (error != 0)
+                        continue;
+
+                r = server_init(server, address, listen_fd, ring_size);
+                if (r >= 0)
+                        r = -pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+
+                if (r < 0)
+                        error = ERROR_PANIC;
+                else
+                        workers[i].started = true;
+        }
+
+        fds[0] = (struct pollfd) { .fd = signal_fd, .events = POLLIN };
+        fds[1] = (struct pollfd) { .fd = exit_fd, .events = POLLIN };
+
+        while (error == 0) {
+                if (poll(fds, ARRAY_SIZE(fds), -1) < 0) {
                         if (errno == EINTR)
                                 continue;
 
-                        return exit_error(ERROR_PANIC);
+                        error = ERROR_PANIC;
+                        break;
                 }
 
-                if (n == 0)
-                        continue;
+                if (fds[0].revents & POLLIN) {
+                        long signo = read_signal(signal_fd);
 
-                if (event.data.ptr == service) {
-                        r = varlink_service_process_events(service);
-                        switch (r) {
-                                case 0:
-                                        break;
+                        PROBE(signal, signo);
 
-                                case -VARLINK_ERROR_PANIC:
-                                        return exit_error(ERROR_PANIC);
+                        switch (signo) {
+                                case SIGUSR1:
+                                        if (profile_enabled)
+                                                print_profile();
+                                        continue;
 
-                                default:
-                                        if (isatty(STDERR_FILENO))
-                                                fprintf(stderr, "Error processing event: %s\n", varlink_error_string(-r));
-                        }
-
-                } else if (event.data.ptr == NULL) {
-                        switch (read_signal(signal_fd)) {
                                 case SIGTERM:
                                 case SIGINT:
-                                        return EXIT_SUCCESS;
+                                        break;
 
                                 default:
-                                        return exit_error(ERROR_PANIC);
+                                        error = ERROR_PANIC;
                         }
 
-                } else {
-                        Monitor *monitor = event.data.ptr;
+                        break;
+                }
 
-                        r = monitor_dispatch(monitor);
-                        switch (r) {
-                                case 0:
-                                        break;
+                if (fds[1].revents & POLLIN)
+                        error = ERROR_PANIC;
+        }
 
-                                case -VARLINK_ERROR_PANIC:
-                                        return exit_error(ERROR_PANIC);
+        eventfd_write(stop_fd, 1);
 
-                                default:
-                                        if (isatty(STDERR_FILENO))
-                                                fprintf(stderr, "Error dispatching message: %s\n", varlink_error_string(-r));
-                        }
-                }
+        for (unsigned long i = 0; i < n_workers; i += 1) {
+                if (workers[i].started)
+                        pthread_join(workers[i].thread, NULL);
+
+                server_deinit(&workers[i].server);
         }
 
+        stats_thread_stop();
+
+        if (profile_enabled)
+                print_profile();
+
+        if (path)
+                unlink(path);
+
+        if (error > 0)
+                return exit_error(error);
+
         return EXIT_SUCCESS;
 }
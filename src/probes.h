@@ -0,0 +1,15 @@
+#pragma once
+
+/*
+ * USDT probes, built in with -Dusdt=true. A probe is a single nop until a
+ * tracer attaches to it, its arguments only cost what it takes to keep
+ * them in registers. They are listed by "perf list sdt_com_redhat_logging:*"
+ * or "bpftrace -l 'usdt:/usr/bin/com.redhat.logging:*'".
+ */
+#if HAVE_USDT
+#include <sys/sdt.h>
+
+#define PROBE(_name, ...) STAP_PROBEV(com_redhat_logging, _name, ##__VA_ARGS__)
+#else
+#define PROBE(_name, ...) do {} while (0)
+#endif
@@ -0,0 +1,45 @@
+#include "profile.h"
+
+bool profile_enabled;
+
+static const char *phase_names[PROFILE_PHASE_MAX] = {
+        [PROFILE_JOURNAL_NEXT] = "journal_next",
+        [PROFILE_READ_ENTRY]   = "read_entry",
+        [PROFILE_GREP]         = "  grep",
+        [PROFILE_GET_DATA]     = "  get_data",
+        [PROFILE_COPY]         = "  copy",
+        [PROFILE_DISPATCH]     = "dispatch",
+        [PROFILE_BUILD_OBJECT] = "  build_object",
+        [PROFILE_FORMAT_TIME]  = "    format_time",
+        [PROFILE_REPLY]        = "  reply"
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TICKS_NAME "cycles"
+#else
+#define TICKS_NAME "ns"
+#endif
+
+void profile_merge(Profile *profile, const Profile *other) {
+        for (unsigned long i = 0; i < PROFILE_PHASE_MAX; i += 1) {
+                profile->calls[i] += __atomic_load_n(&other->calls[i], __ATOMIC_RELAXED);
+                profile->ticks[i] += __atomic_load_n(&other->ticks[i], __ATOMIC_RELAXED);
+        }
+}
+
+void profile_print(const Profile *profile, FILE *file) {
+        fprintf(file, "%-16s %14s %20s %14s\n", "phase", "calls", TICKS_NAME, TICKS_NAME "/call");
+
+        for (unsigned long i = 0; i < PROFILE_PHASE_MAX; i += 1) {
+                uint64_t calls = profile->calls[i];
+                uint64_t ticks = profile->ticks[i];
+
+                fprintf(file, "%-16s %14llu %20llu %14llu\n",
+                        phase_names[i],
+                        (unsigned long long)calls,
+                        (unsigned long long)ticks,
+                        (unsigned long long)(calls > 0 ? ticks / calls : 0));
+        }
+
+        fflush(file);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * The phases of reading and sending entries that --profile times. Phases
+ * that are indented in the output are part of the one above them; get_data
+ * also counts the data grep looks at.
+ */
+typedef enum {
+        PROFILE_JOURNAL_NEXT,
+        PROFILE_READ_ENTRY,
+        PROFILE_GREP,
+        PROFILE_GET_DATA,
+        PROFILE_COPY,
+        PROFILE_DISPATCH,
+        PROFILE_BUILD_OBJECT,
+        PROFILE_FORMAT_TIME,
+        PROFILE_REPLY,
+
+        PROFILE_PHASE_MAX
+} ProfilePhase;
+
+typedef struct {
+        uint64_t calls[PROFILE_PHASE_MAX];
+        uint64_t ticks[PROFILE_PHASE_MAX];
+} Profile;
+
+/* set once before any thread starts */
+extern bool profile_enabled;
+
+/* Returns CPU cycles where reading them is cheap, nanoseconds elsewhere. */
+static inline uint64_t profile_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Returns the start of a phase, for stats_profile(). */
+static inline uint64_t profile_begin(void) {
+        return profile_enabled ? profile_ticks() : 0;
+}
+
+void profile_merge(Profile *profile, const Profile *other);
+void profile_print(const Profile *profile, FILE *file);
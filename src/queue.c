@@ -0,0 +1,81 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "queue.h"
+
+struct Queue {
+        void **items;
+
+        /* a power of two, the indexes wrap around with it */
+        unsigned long size;
+
+        /* on separate cache lines, each is written by one side only */
+        unsigned long head __attribute__((__aligned__(64)));
+        unsigned long tail __attribute__((__aligned__(64)));
+};
+
+long queue_new(Queue **queuep, unsigned long size) {
+        Queue *queue;
+        unsigned long n_items = 1;
+
+        if (size == 0)
+                return -EINVAL;
+
+        while (n_items < size)
+                n_items *= 2;
+
+        queue = calloc(1, sizeof(Queue));
+        queue->items = calloc(n_items, sizeof(void *));
+        queue->size = n_items;
+
+        *queuep = queue;
+
+        return 0;
+}
+
+Queue *queue_free(Queue *queue) {
+        free(queue->items);
+        free(queue);
+
+        return NULL;
+}
+
+void queue_freep(Queue **queuep) {
+        if (*queuep)
+                queue_free(*queuep);
+}
+
+bool queue_push(Queue *queue, void *item) {
+        unsigned long tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+        if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->size)
+                return false;
+
+        queue->items[tail & (queue->size - 1)] = item;
+        __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+        return true;
+}
+
+bool queue_is_full(Queue *queue) {
+        return __atomic_load_n(&queue->tail, __ATOMIC_RELAXED) -
+               __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->size;
+}
+
+void *queue_pop(Queue *queue) {
+        unsigned long head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        void *item;
+
+        if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+                return NULL;
+
+        item = queue->items[head & (queue->size - 1)];
+        __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+        return item;
+}
+
+bool queue_is_empty(Queue *queue) {
+        return __atomic_load_n(&queue->head, __ATOMIC_RELAXED) ==
+               __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
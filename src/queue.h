@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * A bounded queue of pointers from one producer thread to one consumer
+ * thread. It does not lock: each side only writes its own index and
+ * publishes it with release semantics.
+ */
+typedef struct Queue Queue;
+
+long queue_new(Queue **queuep, unsigned long size);
+Queue *queue_free(Queue *queue);
+void queue_freep(Queue **queuep);
+
+/* the producer side, returns false if the queue is full */
+bool queue_push(Queue *queue, void *item);
+bool queue_is_full(Queue *queue);
+
+/* the consumer side, returns NULL if the queue is empty */
+void *queue_pop(Queue *queue);
+bool queue_is_empty(Queue *queue);
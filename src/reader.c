@@ -0,0 +1,1349 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <linux/sockios.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "reader.h"
+#include "stats.h"
+#include "util.h"
+
+/* how often a subscription that used up its limits looks at its socket */
+#define REFILL_USEC (10 * 1000)
+
+/*
+ * Entries that one read from the journal looks at without using them, as
+ * they do not match the patterns or lie outside of a query's range. It
+ * stops there and continues in the next dispatch or with the next page.
+ */
+#define MAX_SKIPPED_ENTRIES 10000
+
+struct ReaderSubscription {
+        ReaderSubscription *next;
+        ReaderSubscription *previous;
+
+        ReaderEntriesCallback callback;
+        void *userdata;
+
+        ReaderOptions options;
+
+        /* What was handed to the callback since the limits were renewed,
+         * which is tried at @refill_usec. @blocked is set once an entry did
+         * not fit. */
+        unsigned long pending_entries;
+        unsigned long pending_bytes;
+        uint64_t refill_usec;
+        bool blocked;
+
+        /* the callback failed, nothing is delivered anymore */
+        bool closed;
+
+        /* entries left out since the last delivery */
+        unsigned long n_dropped;
+
+        /* The subscription reads its initial lines or the entries it
+         * could not take in time from the journal. The last entry it
+         * received is @skip entries before @cursor. */
+        bool catching_up;
+        char *cursor;
+        unsigned long skip;
+
+        /* live entries held back to fill a delivery, until @deadline_usec */
+        Entry **held;
+        unsigned long n_held;
+        char *held_cursor;
+        uint64_t deadline_usec;
+
+        /* new entries per microsecond, and when the last ones came */
+        double rate;
+        uint64_t last_usec;
+};
+
+struct Reader {
+        sd_journal *journal;
+
+        /* only entries matching it are read */
+        Filter filter;
+        Grep *grep;
+
+        /* the last entry handed to the subscriptions */
+        char *cursor;
+
+        /* New entries come from the feed of the filter, which signals
+         * @ready_fd when there are batches; one is handed out per
+         * dispatch. The journal above is only used to read older entries,
+         * from the event loop. */
+        FeedSet *feeds;
+        FeedQueue *feed;
+        int ready_fd;
+        bool pending;
+
+        /* the most recent entries, the newest one is at ring_end - 1 */
+        Entry **ring;
+        unsigned long ring_size;
+        unsigned long ring_end;
+        unsigned long n_ring;
+
+        ReaderSubscription *subscriptions;
+
+        /* what new entries are read with: the fields of the ring and
+         * of all subscriptions */
+        EntryFields default_fields;
+        EntryFields fields;
+
+        /* On the unfiltered feed, what the entries need to be matched.
+         * The cursor is then the one of the last entry that the journal
+         * above visits, which entries of the feed are not. */
+        EntryFields match_fields;
+};
+
+/*
+ * The journal is not polled, it picks up added and removed journal files
+ * when it is used. The feed may already read from files it does not know.
+ */
+static long reader_process_journal(Reader *reader) {
+        long r;
+
+        r = sd_journal_process(reader->journal);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
+/*
+ * Positions the journal on the entry of @cursor, so that the next entry
+ * read follows it, or before the first entry without a cursor.
+ */
+static long reader_seek_cursor(Reader *reader, const char *cursor) {
+        long r;
+
+        r = reader_process_journal(reader);
+        if (r < 0)
+                return r;
+
+        if (!cursor)
+                return sd_journal_seek_head(reader->journal);
+
+        r = sd_journal_seek_cursor(reader->journal, cursor);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_next(reader->journal);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
+/*
+ * Moves back from the current entry over the last *@n_entriesp entries that
+ * match the reader's patterns, including the current one, so that the next
+ * entry read is the first of them. Returns 0 if there are fewer, and -EAGAIN
+ * after MAX_SKIPPED_ENTRIES entries that do not match. The journal is then
+ * on the entry to look at next, with *@n_entriesp entries left.
+ */
+static long reader_skip_back(Reader *reader, unsigned long *n_entriesp) {
+        unsigned long n_skipped = 0;
+        long r;
+
+        if (!reader->grep) {
+                r = sd_journal_previous_skip(reader->journal, MIN(*n_entriesp, INT_MAX));
+                if (r < 0)
+                        return r;
+
+                return (unsigned long)r == *n_entriesp;
+        }
+
+        while (*n_entriesp > 0) {
+                if (n_skipped == MAX_SKIPPED_ENTRIES)
+                        return -EAGAIN;
+
+                r = journal_test_message(reader->journal, reader->grep);
+                if (r < 0)
+                        return r;
+
+                if (r > 0)
+                        *n_entriesp -= 1;
+                else
+                        n_skipped += 1;
+
+                r = sd_journal_previous(reader->journal);
+                if (r <= 0)
+                        return r;
+        }
+
+        return 1;
+}
+
+/*
+ * Positions the journal *@n_linesp entries before the current one, so that
+ * the next entry read is the first of the last *@n_linesp up to it. Returns
+ * -EAGAIN like reader_skip_back().
+ */
+static long reader_seek_lines_back(Reader *reader, unsigned long *n_linesp) {
+        long r;
+
+        r = reader_skip_back(reader, n_linesp);
+        if (r < 0)
+                return r;
+
+        /* fewer entries than requested, start reading at the first one */
+        if (r == 0) {
+                r = sd_journal_seek_head(reader->journal);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+/*
+ * Reads up to @max_entries entries following the current position of the
+ * journal, and the cursor of the last one read into @cursorp. With
+ * @stop_at_cursor, reading stops after the reader's last entry. Returns 1
+ * once there is nothing more to read. Reading also stops after
+ * MAX_SKIPPED_ENTRIES entries that do not match the patterns, maybe
+ * without any entries.
+ */
+static long reader_read_entries(Reader *reader,
+                                unsigned long max_entries,
+                                bool stop_at_cursor,
+                                const EntryFields *fields,
+                                Entry ***entriesp,
+                                unsigned long *n_entriesp,
+                                char **cursorp) {
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        unsigned long n_allocated = 0;
+        unsigned long n_skipped = 0;
+        bool done = false;
+        long r;
+
+        journal_set_data_threshold(reader->journal, fields, reader->grep);
+
+        while (n_entries < max_entries) {
+                Entry *entry;
+
+                r = journal_read_next_entry(reader->journal, fields, reader->grep, &entry);
+                if (r < 0) {
+                        entry_array_free(entries, n_entries);
+                        return r;
+                }
+
+                if (r == 0) {
+                        done = true;
+                        break;
+                }
+
+                /* not matching the patterns, but read past */
+                if (!entry) {
+                        n_skipped += 1;
+
+                        if (stop_at_cursor && sd_journal_test_cursor(reader->journal, reader->cursor) > 0) {
+                                done = true;
+                                break;
+                        }
+
+                        if (n_skipped == MAX_SKIPPED_ENTRIES)
+                                break;
+
+                        continue;
+                }
+
+                if (n_entries == n_allocated) {
+                        n_allocated = MAX(n_allocated * 2, 16);
+                        entries = realloc(entries, n_allocated * sizeof(Entry *));
+                }
+
+                entries[n_entries] = entry;
+                n_entries += 1;
+
+                if (stop_at_cursor && sd_journal_test_cursor(reader->journal, reader->cursor) > 0) {
+                        done = true;
+                        break;
+                }
+        }
+
+        *cursorp = NULL;
+
+        /* next() failed at the end, the journal is still on the last entry */
+        if (n_entries > 0 || n_skipped > 0) {
+                r = sd_journal_get_cursor(reader->journal, cursorp);
+                if (r < 0) {
+                        entry_array_free(entries, n_entries);
+                        return r;
+                }
+        }
+
+        *entriesp = entries;
+        *n_entriesp = n_entries;
+
+        return done;
+}
+
+static void reader_ring_push(Reader *reader, Entry *entry) {
+        if (reader->ring_size == 0)
+                return;
+
+        if (reader->n_ring == reader->ring_size)
+                entry_unref(reader->ring[reader->ring_end]);
+        else
+                reader->n_ring += 1;
+
+        reader->ring[reader->ring_end] = entry_ref(entry);
+        reader->ring_end = (reader->ring_end + 1) % reader->ring_size;
+}
+
+/*
+ * Returns the last @n_entries entries of the ring, or NULL if the ring does
+ * not hold that many, or some of them lack the fields that are asked for.
+ */
+static Entry **reader_ring_get(Reader *reader, unsigned long n_entries, const EntryFields *fields) {
+        Entry **entries;
+        unsigned long start;
+
+        if (n_entries > reader->n_ring)
+                return NULL;
+
+        if (n_entries == 0)
+                return calloc(1, sizeof(Entry *));
+
+        start = (reader->ring_end + reader->ring_size - n_entries) % reader->ring_size;
+
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                if (!entry_has_fields(reader->ring[(start + i) % reader->ring_size], fields))
+                        return NULL;
+
+        entries = calloc(n_entries, sizeof(Entry *));
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                entries[i] = entry_ref(reader->ring[(start + i) % reader->ring_size]);
+
+        return entries;
+}
+
+/*
+ * New entries are read with the default fields, which the ring keeps for
+ * monitors that do not ask for anything else, and the fields of all
+ * subscriptions.
+ */
+static void reader_update_fields(Reader *reader) {
+        entry_fields_clear(&reader->fields);
+        entry_fields_copy(&reader->fields, &reader->default_fields);
+
+        for (ReaderSubscription *subscription = reader->subscriptions; subscription; subscription = subscription->next)
+                entry_fields_merge(&reader->fields, &subscription->options.fields);
+
+        if (reader->feed)
+                feed_queue_set_fields(reader->feed, &reader->fields);
+}
+
+/*
+ * Moves the cursor to the last entry of the reader's journal up to @cursor,
+ * a position of the unfiltered feed. It stays if there is none.
+ */
+static long reader_set_matched_cursor(Reader *reader, const char *cursor) {
+        char *matched;
+        long r;
+
+        if (!cursor)
+                return 0;
+
+        r = reader_process_journal(reader);
+        if (r < 0)
+                return r;
+
+        /* the entry of the cursor itself comes first, if it matches */
+        r = sd_journal_seek_cursor(reader->journal, cursor);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_previous(reader->journal);
+        if (r <= 0)
+                return r;
+
+        r = sd_journal_get_cursor(reader->journal, &matched);
+        if (r < 0)
+                return r;
+
+        free(reader->cursor);
+        reader->cursor = matched;
+
+        return 0;
+}
+
+/* New entries follow the position of the feed, which becomes the reader's. */
+static long reader_start_feed(Reader *reader) {
+        _cleanup_(freep) char *cursor = NULL;
+        long r;
+
+        r = feed_queue_new(&reader->feed, reader->feeds, &reader->filter, &reader->fields, reader->ready_fd, &cursor);
+        if (r < 0)
+                return r;
+
+        free(reader->cursor);
+        reader->cursor = NULL;
+
+        if (feed_queue_is_unfiltered(reader->feed)) {
+                entry_fields_clear(&reader->match_fields);
+                filter_add_fields(&reader->filter, &reader->match_fields);
+                reader->match_fields.mask |= ENTRY_FIELD_CURSOR;
+
+                return reader_set_matched_cursor(reader, cursor);
+        }
+
+        reader->cursor = cursor;
+        cursor = NULL;
+
+        return 0;
+}
+
+long reader_new(Reader **readerp,
+                FeedSet *feeds,
+                const Filter *filter,
+                const EntryFields *fields,
+                unsigned long ring_size) {
+        _cleanup_(reader_freep) Reader *reader = NULL;
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        long r;
+
+        reader = calloc(1, sizeof(Reader));
+        reader->ready_fd = -1;
+        reader->feeds = feeds;
+        entry_fields_copy(&reader->default_fields, fields);
+        entry_fields_copy(&reader->fields, fields);
+
+        if (ring_size > 0) {
+                reader->ring = calloc(ring_size, sizeof(Entry *));
+                reader->ring_size = ring_size;
+        }
+
+        reader->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reader->ready_fd < 0)
+                return -errno;
+
+        r = sd_journal_open(&reader->journal, SD_JOURNAL_LOCAL_ONLY);
+        if (r < 0)
+                return r;
+
+        /* Makes sure the inotify watches exist before the first
+         * sd_journal_process() call. */
+        if (sd_journal_get_fd(reader->journal) < 0)
+                return -EBADF;
+
+        if (filter) {
+                filter_copy(&reader->filter, filter);
+
+                r = filter_apply(&reader->filter, reader->journal);
+                if (r < 0)
+                        return r;
+
+                if (filter->n_patterns > 0) {
+                        r = grep_new(&reader->grep, reader->filter.patterns, reader->filter.n_patterns);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        if (ring_size > 0) {
+                /* the ring is kept up to date even without subscriptions */
+                r = reader_start_feed(reader);
+                if (r < 0)
+                        return r;
+        } else {
+                /* start after the last entry, if there is one */
+                r = sd_journal_seek_tail(reader->journal);
+                if (r >= 0)
+                        r = sd_journal_previous(reader->journal);
+                if (r > 0)
+                        r = sd_journal_get_cursor(reader->journal, &reader->cursor);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Fill the ring, so that the first clients do not need to seek. */
+        r = reader_read_backlog(reader, ring_size, &reader->fields, &entries, &n_entries);
+        if (r < 0)
+                return r;
+
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                reader_ring_push(reader, entries[i]);
+
+        entry_array_free(entries, n_entries);
+
+        *readerp = reader;
+        reader = NULL;
+
+        return 0;
+}
+
+Reader *reader_free(Reader *reader) {
+        if (reader->feed)
+                reader->feed = feed_queue_free(reader->feed);
+
+        while (reader->subscriptions)
+                reader_unsubscribe(reader, reader->subscriptions);
+
+        if (reader->journal)
+                sd_journal_close(reader->journal);
+
+        for (unsigned long i = 0; i < reader->n_ring; i += 1)
+                entry_unref(reader->ring[i]);
+
+        free(reader->ring);
+
+        entry_fields_clear(&reader->default_fields);
+        entry_fields_clear(&reader->fields);
+        entry_fields_clear(&reader->match_fields);
+        filter_clear(&reader->filter);
+        if (reader->grep)
+                grep_free(reader->grep);
+
+        if (reader->ready_fd >= 0)
+                close(reader->ready_fd);
+
+        free(reader->cursor);
+        free(reader);
+
+        return NULL;
+}
+
+void reader_freep(Reader **readerp) {
+        if (*readerp)
+                reader_free(*readerp);
+}
+
+/* Readable when there are new entries to dispatch. */
+int reader_get_fd(Reader *reader) {
+        return reader->ready_fd;
+}
+
+const char *reader_get_cursor(Reader *reader) {
+        return reader->cursor;
+}
+
+const Filter *reader_get_filter(Reader *reader) {
+        return &reader->filter;
+}
+
+bool reader_has_subscriptions(Reader *reader) {
+        return reader->subscriptions != NULL;
+}
+
+long reader_process(Reader *reader) {
+        eventfd_t value;
+
+        if (eventfd_read(reader->ready_fd, &value) < 0 && errno != EAGAIN)
+                return -VARLINK_ERROR_PANIC;
+
+        reader->pending = true;
+
+        return 0;
+}
+
+/*
+ * Returns how many of @entries the subscription can still take before its
+ * limits are renewed. The first entry after that is always taken, so that
+ * every subscription makes progress.
+ */
+static unsigned long subscription_fit(ReaderSubscription *subscription, Entry **entries, unsigned long n_entries) {
+        unsigned long n_entries_fit = 0;
+        unsigned long bytes = subscription->pending_bytes;
+
+        while (n_entries_fit < n_entries) {
+                unsigned long n_pending = subscription->pending_entries + n_entries_fit;
+
+                if (n_pending > 0 &&
+                    (n_pending >= subscription->options.max_pending_entries ||
+                     bytes + entries[n_entries_fit]->size > subscription->options.max_pending_bytes))
+                        break;
+
+                bytes += entries[n_entries_fit]->size;
+                n_entries_fit += 1;
+        }
+
+        if (n_entries_fit < n_entries)
+                subscription->blocked = true;
+
+        return n_entries_fit;
+}
+
+static void subscription_account(ReaderSubscription *subscription, Entry **entries, unsigned long n_entries) {
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                subscription->pending_bytes += entries[i]->size;
+
+        subscription->pending_entries += n_entries;
+
+        /* the interval starts with the first delivery */
+        if (subscription->refill_usec == 0 && n_entries > 0)
+                subscription->refill_usec = now(CLOCK_MONOTONIC) + REFILL_USEC;
+}
+
+/*
+ * The kernel took what libvarlink buffered once less than half of the send
+ * buffer is queued; libvarlink only buffers replies while it is full.
+ */
+static bool socket_is_drained(int fd) {
+        int n_unsent;
+        int size;
+        socklen_t length = sizeof(size);
+
+        /* a closed connection ends the subscription soon */
+        if (ioctl(fd, SIOCOUTQ, &n_unsent) < 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &length) < 0)
+                return true;
+
+        return n_unsent < size / 2;
+}
+
+/*
+ * Renews the limits once the client read what it was handed, as far as its
+ * socket tells. Without a socket, they are renewed every REFILL_USEC.
+ */
+static void subscription_refill(ReaderSubscription *subscription, uint64_t now_usec) {
+        if (subscription->refill_usec == 0 || subscription->refill_usec > now_usec)
+                return;
+
+        if (subscription->options.fd >= 0 && !socket_is_drained(subscription->options.fd)) {
+                subscription->refill_usec = now_usec + REFILL_USEC;
+                return;
+        }
+
+        subscription->pending_entries = 0;
+        subscription->pending_bytes = 0;
+        subscription->refill_usec = 0;
+        subscription->blocked = false;
+}
+
+static void subscription_set_catching_up(ReaderSubscription *subscription, const char *cursor, unsigned long skip) {
+        free(subscription->cursor);
+        subscription->cursor = cursor ? strdup(cursor) : NULL;
+        subscription->skip = skip;
+
+        if (!subscription->catching_up) {
+                subscription->catching_up = true;
+                STATS_ADD(lagging_monitors, 1);
+        }
+}
+
+static void subscription_set_caught_up(ReaderSubscription *subscription) {
+        free(subscription->cursor);
+        subscription->cursor = NULL;
+
+        if (subscription->catching_up) {
+                subscription->catching_up = false;
+                STATS_ADD(lagging_monitors, -1);
+        }
+}
+
+/*
+ * Hands @entries to the callback in chunks. @cursor belongs to the last
+ * entry and goes with the last chunk. A failed delivery closes the
+ * subscription, the client would miss the entries otherwise.
+ */
+static void subscription_call(ReaderSubscription *subscription,
+                              Entry **entries,
+                              unsigned long n_entries,
+                              const char *cursor) {
+        unsigned long i = 0;
+
+        if (subscription->closed)
+                return;
+
+        /* the first delivery is made even without entries */
+        do {
+                unsigned long n = MIN(n_entries - i, subscription->options.max_entries);
+
+                if (subscription->callback(entries + i,
+                                           n,
+                                           subscription->n_dropped,
+                                           i + n == n_entries ? cursor : NULL,
+                                           subscription->userdata) < 0) {
+                        subscription->closed = true;
+                        subscription_set_caught_up(subscription);
+                        return;
+                }
+
+                subscription->n_dropped = 0;
+                i += n;
+        } while (i < n_entries);
+}
+
+static void subscription_flush(ReaderSubscription *subscription) {
+        if (subscription->n_held == 0)
+                return;
+
+        subscription_call(subscription, subscription->held, subscription->n_held, subscription->held_cursor);
+
+        entry_array_free(subscription->held, subscription->n_held);
+        free(subscription->held_cursor);
+        subscription->held = NULL;
+        subscription->n_held = 0;
+        subscription->held_cursor = NULL;
+        subscription->deadline_usec = 0;
+}
+
+static void subscription_deliver(ReaderSubscription *subscription,
+                                 Entry **entries,
+                                 unsigned long n_entries,
+                                 const char *cursor) {
+        subscription_account(subscription, entries, n_entries);
+
+        /* held entries came first */
+        if (subscription->n_held > 0) {
+                subscription_flush(subscription);
+                if (n_entries == 0)
+                        return;
+        }
+
+        subscription_call(subscription, entries, n_entries, cursor);
+}
+
+static void subscription_update_rate(ReaderSubscription *subscription, unsigned long n_entries, uint64_t now_usec) {
+        if (subscription->last_usec > 0 && now_usec > subscription->last_usec) {
+                double rate = (double)n_entries / (now_usec - subscription->last_usec);
+
+                subscription->rate = subscription->rate * 0.75 + rate * 0.25;
+        }
+
+        subscription->last_usec = now_usec;
+}
+
+/*
+ * Holds live entries back to deliver them together, until a delivery is
+ * full or the delay is over. The delay is what it takes to fill a delivery
+ * at the rate entries came in so far, but at most max_delay_usec. When not
+ * even two entries are expected in that time, they are delivered right away.
+ */
+static void subscription_hold(ReaderSubscription *subscription,
+                              Entry **entries,
+                              unsigned long n_entries,
+                              const char *cursor,
+                              uint64_t now_usec) {
+        uint64_t max_delay_usec = subscription->options.max_delay_usec;
+        uint64_t delay_usec;
+
+        subscription_update_rate(subscription, n_entries, now_usec);
+        subscription_account(subscription, entries, n_entries);
+
+        subscription->held = realloc(subscription->held, (subscription->n_held + n_entries) * sizeof(Entry *));
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                subscription->held[subscription->n_held + i] = entry_ref(entries[i]);
+
+        subscription->n_held += n_entries;
+        free(subscription->held_cursor);
+        subscription->held_cursor = strdup(cursor);
+
+        if (subscription->n_held >= subscription->options.max_entries ||
+            subscription->rate * max_delay_usec < 2) {
+                subscription_flush(subscription);
+                return;
+        }
+
+        if (subscription->deadline_usec > 0)
+                return;
+
+        delay_usec = (subscription->options.max_entries - subscription->n_held) / subscription->rate;
+        subscription->deadline_usec = now_usec + MIN(delay_usec, max_delay_usec);
+}
+
+/*
+ * Delivers new entries to a live subscription. The ones that do not fit
+ * into its limits are dropped and counted, or read again from the journal
+ * in later dispatches.
+ */
+static void subscription_deliver_live(ReaderSubscription *subscription,
+                                      Entry **entries,
+                                      unsigned long n_entries,
+                                      const char *cursor,
+                                      uint64_t now_usec) {
+        unsigned long n_entries_fit;
+
+        /* nothing was delivered in this dispatch yet, the first entry fits */
+        n_entries_fit = subscription_fit(subscription, entries, n_entries);
+
+        if (n_entries_fit < n_entries) {
+                if (subscription->options.drop) {
+                        subscription->n_dropped += n_entries - n_entries_fit;
+                        STATS_ADD(entries_dropped, n_entries - n_entries_fit);
+                } else
+                        subscription_set_catching_up(subscription, cursor, n_entries - n_entries_fit);
+
+                cursor = NULL;
+        }
+
+        /* entries that are behind are not held back */
+        if (subscription->options.max_delay_usec > 0 && cursor)
+                subscription_hold(subscription, entries, n_entries_fit, cursor, now_usec);
+        else
+                subscription_deliver(subscription, entries, n_entries_fit, cursor);
+}
+
+/*
+ * Delivers entries read from the journal to a subscription that catches
+ * up. It continues to catch up from the last delivered entry if not all
+ * of them fit, or if reading stopped before the live position (!@done).
+ */
+static void subscription_deliver_catch_up(ReaderSubscription *subscription,
+                                          Entry **entries,
+                                          unsigned long n_entries,
+                                          const char *cursor,
+                                          bool done) {
+        unsigned long n_entries_fit;
+
+        n_entries_fit = subscription_fit(subscription, entries, n_entries);
+
+        if (n_entries_fit < n_entries || !done) {
+                /* without progress, it continues where it was */
+                if (n_entries_fit > 0)
+                        subscription_set_catching_up(subscription, cursor, n_entries - n_entries_fit);
+        } else
+                subscription_set_caught_up(subscription);
+
+        if (n_entries_fit > 0)
+                subscription_deliver(subscription,
+                                     entries,
+                                     n_entries_fit,
+                                     n_entries_fit == n_entries ? cursor : NULL);
+}
+
+static bool entries_have_fields(Entry **entries, unsigned long n_entries, const EntryFields *fields) {
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                if (!entry_has_fields(entries[i], fields))
+                        return false;
+
+        return true;
+}
+
+/*
+ * Drops the entries of the unfiltered feed that the filter does not match,
+ * and moves the cursor to the last one its journal visits. Returns false,
+ * leaving both alone, if entries were read before the feed had the fields
+ * to match them.
+ */
+static bool reader_match_batch(Reader *reader, FeedBatch *batch) {
+        unsigned long n_entries = 0;
+
+        if (!entries_have_fields(batch->entries, batch->n_entries, &reader->match_fields))
+                return false;
+
+        /* the journal visits the entries that match, whatever their message */
+        for (unsigned long i = batch->n_entries; i > 0; i -= 1) {
+                if (filter_match_entry(&reader->filter, batch->entries[i - 1])) {
+                        free(reader->cursor);
+                        reader->cursor = strdup(batch->entries[i - 1]->cursor);
+                        break;
+                }
+        }
+
+        for (unsigned long i = 0; i < batch->n_entries; i += 1) {
+                Entry *entry = batch->entries[i];
+
+                if (filter_match_entry(&reader->filter, entry) &&
+                    (!reader->grep || (entry->message && grep_match(reader->grep, entry->message, entry->message_length)))) {
+                        batch->entries[n_entries] = entry;
+                        n_entries += 1;
+                } else
+                        entry_unref(entry);
+        }
+
+        batch->n_entries = n_entries;
+
+        return true;
+}
+
+static long reader_dispatch_live(Reader *reader, uint64_t now_usec) {
+        _cleanup_(feed_batch_freep) FeedBatch *batch = NULL;
+        _cleanup_(freep) char *previous_cursor = NULL;
+        ReaderSubscription *subscription;
+        long r;
+
+        r = feed_queue_pop(reader->feed, &batch);
+        if (r < 0)
+                return r;
+
+        reader->pending = feed_queue_has_batches(reader->feed);
+
+        if (!batch)
+                return 0;
+
+        if (feed_queue_is_unfiltered(reader->feed)) {
+                previous_cursor = reader->cursor ? strdup(reader->cursor) : NULL;
+
+                if (!reader_match_batch(reader, batch)) {
+                        r = reader_set_matched_cursor(reader, batch->cursor);
+                        if (r < 0)
+                                return r;
+
+                        /* the subscriptions read them from the journal */
+                        for (subscription = reader->subscriptions; subscription; subscription = subscription->next)
+                                if (!subscription->catching_up && !subscription->closed)
+                                        subscription_set_catching_up(subscription, previous_cursor, 0);
+
+                        return 0;
+                }
+        } else {
+                /* also moves past entries that did not match the patterns */
+                previous_cursor = reader->cursor;
+                reader->cursor = batch->cursor;
+                batch->cursor = NULL;
+        }
+
+        if (batch->n_entries == 0)
+                return 0;
+
+        for (unsigned long i = 0; i < batch->n_entries; i += 1)
+                reader_ring_push(reader, batch->entries[i]);
+
+        subscription = reader->subscriptions;
+        while (subscription) {
+                /* the callback may unsubscribe itself */
+                ReaderSubscription *next = subscription->next;
+
+                if (!subscription->catching_up && !subscription->closed) {
+                        /* decoded before the subscription asked for more
+                         * fields, they are read again */
+                        if (entries_have_fields(batch->entries, batch->n_entries, &subscription->options.fields))
+                                subscription_deliver_live(subscription,
+                                                          batch->entries,
+                                                          batch->n_entries,
+                                                          reader->cursor,
+                                                          now_usec);
+                        else
+                                subscription_set_catching_up(subscription, previous_cursor, 0);
+                }
+
+                subscription = next;
+        }
+
+        return 0;
+}
+
+static unsigned long subscription_get_chunk_size(ReaderSubscription *subscription) {
+        unsigned long n_left = subscription->options.max_pending_entries - MIN(subscription->pending_entries, subscription->options.max_pending_entries);
+
+        return MAX(MIN(subscription->options.max_entries, n_left), 1);
+}
+
+static long reader_dispatch_catch_up(Reader *reader, ReaderSubscription *subscription) {
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        _cleanup_(freep) char *cursor = NULL;
+        unsigned long skip = subscription->skip;
+        long r;
+
+        r = reader_seek_cursor(reader, subscription->cursor);
+        if (r < 0)
+                return r;
+
+        if (skip > 0) {
+                r = reader_seek_lines_back(reader, &skip);
+                if (r == -EAGAIN) {
+                        /* the rest of the way back is for the next dispatch */
+                        r = sd_journal_get_cursor(reader->journal, &cursor);
+                        if (r < 0)
+                                return r;
+
+                        subscription_set_catching_up(subscription, cursor, skip);
+                        return 0;
+                }
+                if (r < 0)
+                        return r;
+        }
+
+        r = reader_read_entries(reader,
+                                subscription_get_chunk_size(subscription),
+                                true,
+                                &subscription->options.fields,
+                                &entries,
+                                &n_entries,
+                                &cursor);
+        if (r < 0)
+                return r;
+
+        if (n_entries > 0)
+                subscription_deliver_catch_up(subscription, entries, n_entries, cursor, r > 0);
+        else if (r == 0)
+                /* only read past entries that do not match */
+                subscription_set_catching_up(subscription, cursor, 0);
+        else
+                subscription_set_caught_up(subscription);
+
+        entry_array_free(entries, n_entries);
+
+        return 0;
+}
+
+/*
+ * Reads at most one batch of new entries for the live subscriptions and
+ * one chunk of initial lines for each subscription that is catching up
+ * and within its limits. Returns 1 if there is more to do right away.
+ */
+long reader_dispatch(Reader *reader) {
+        ReaderSubscription *subscription;
+        uint64_t now_usec = now(CLOCK_MONOTONIC);
+        long r;
+
+        for (subscription = reader->subscriptions; subscription; subscription = subscription->next) {
+                subscription_refill(subscription, now_usec);
+
+                if (subscription->n_held > 0 && subscription->deadline_usec <= now_usec)
+                        subscription_flush(subscription);
+        }
+
+        if (reader->feed && reader->pending) {
+                r = reader_dispatch_live(reader, now_usec);
+                if (r < 0)
+                        return -VARLINK_ERROR_PANIC;
+        }
+
+        subscription = reader->subscriptions;
+        while (subscription) {
+                ReaderSubscription *next = subscription->next;
+
+                /* the ones that just fell behind continue after the refill */
+                if (subscription->catching_up && !subscription->blocked) {
+                        r = reader_dispatch_catch_up(reader, subscription);
+                        if (r < 0)
+                                return -VARLINK_ERROR_PANIC;
+                }
+
+                subscription = next;
+        }
+
+        for (subscription = reader->subscriptions; subscription; subscription = subscription->next)
+                if (subscription->catching_up && !subscription->blocked)
+                        return 1;
+
+        return reader->pending;
+}
+
+/*
+ * Returns when the reader needs to be dispatched next without new entries,
+ * in microseconds of CLOCK_MONOTONIC: when the first of the entries held
+ * back for subscriptions are due, or a subscription that is catching up
+ * gets its limits renewed. UINT64_MAX if there is no such time.
+ */
+uint64_t reader_get_deadline(Reader *reader) {
+        uint64_t deadline_usec = UINT64_MAX;
+
+        for (ReaderSubscription *subscription = reader->subscriptions; subscription; subscription = subscription->next) {
+                if (subscription->n_held > 0)
+                        deadline_usec = MIN(deadline_usec, subscription->deadline_usec);
+
+                if (subscription->catching_up && subscription->blocked)
+                        deadline_usec = MIN(deadline_usec, subscription->refill_usec);
+        }
+
+        return deadline_usec;
+}
+
+/*
+ * Returns the @n_lines entries up to and including the reader's last entry.
+ * They are taken from the ring if it holds enough of them and read from the
+ * journal otherwise.
+ */
+long reader_read_backlog(Reader *reader,
+                         unsigned long n_lines,
+                         const EntryFields *fields,
+                         Entry ***entriesp,
+                         unsigned long *n_entriesp) {
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        _cleanup_(freep) char *cursor = NULL;
+        unsigned long n_skip = n_lines;
+        long r;
+
+        if (n_lines == 0 || !reader->cursor) {
+                *entriesp = NULL;
+                *n_entriesp = 0;
+                return 0;
+        }
+
+        entries = reader_ring_get(reader, n_lines, fields);
+        if (entries) {
+                *entriesp = entries;
+                *n_entriesp = n_lines;
+
+                return 0;
+        }
+
+        /* with too many entries in between that do not match, there are fewer */
+        r = reader_seek_cursor(reader, reader->cursor);
+        if (r >= 0)
+                r = reader_seek_lines_back(reader, &n_skip);
+        if (r >= 0 || r == -EAGAIN)
+                r = reader_read_entries(reader, n_lines, true, fields, &entries, &n_entries, &cursor);
+        if (r < 0)
+                return -VARLINK_ERROR_PANIC;
+
+        *entriesp = entries;
+        *n_entriesp = n_entries;
+
+        return 0;
+}
+
+/*
+ * Positions the journal so that reading in the direction of @query starts
+ * with the first entry of its range.
+ */
+static long reader_seek_query(Reader *reader, const ReaderQuery *query) {
+        const char *cursor = query->backward ? query->before : query->after;
+        long r;
+
+        r = reader_process_journal(reader);
+        if (r < 0)
+                return r;
+
+        if (cursor) {
+                r = sd_journal_seek_cursor(reader->journal, cursor);
+                if (r < 0)
+                        return r;
+
+                /* step onto the entry, which is not part of the range */
+                r = query->backward ? sd_journal_previous(reader->journal) : sd_journal_next(reader->journal);
+                if (r <= 0 || sd_journal_test_cursor(reader->journal, cursor) > 0)
+                        return r;
+
+                /* the entry is gone, step back so that the closest one is read first */
+                r = query->backward ? sd_journal_next(reader->journal) : sd_journal_previous(reader->journal);
+                if (r != 0)
+                        return r;
+
+                return query->backward ? sd_journal_seek_tail(reader->journal) : sd_journal_seek_head(reader->journal);
+        }
+
+        if (query->backward)
+                return query->until_usec < UINT64_MAX ? sd_journal_seek_realtime_usec(reader->journal, query->until_usec) :
+                                                        sd_journal_seek_tail(reader->journal);
+
+        return query->since_usec > 0 ? sd_journal_seek_realtime_usec(reader->journal, query->since_usec) :
+                                       sd_journal_seek_head(reader->journal);
+}
+
+static long reader_read_query(Reader *reader,
+                              const ReaderQuery *query,
+                              const EntryFields *fields,
+                              Entry ***entriesp,
+                              unsigned long *n_entriesp,
+                              char **cursorp) {
+        const char *end = query->backward ? query->after : query->before;
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        unsigned long n_allocated = 0;
+        unsigned long n_skipped = 0;
+        bool done = false;
+        long r;
+
+        r = reader_seek_query(reader, query);
+        if (r < 0)
+                return r;
+
+        journal_set_data_threshold(reader->journal, fields, reader->grep);
+
+        while (n_entries < query->limit && n_skipped < MAX_SKIPPED_ENTRIES) {
+                _cleanup_(entry_unrefp) Entry *entry = NULL;
+                bool before_range;
+                bool after_range;
+
+                if (query->backward)
+                        r = journal_read_previous_entry(reader->journal, fields, reader->grep, &entry);
+                else
+                        r = journal_read_next_entry(reader->journal, fields, reader->grep, &entry);
+                if (r < 0) {
+                        entry_array_free(entries, n_entries);
+                        return r;
+                }
+
+                if (r == 0 || (end && sd_journal_test_cursor(reader->journal, end) > 0)) {
+                        done = true;
+                        break;
+                }
+
+                if (!entry) {
+                        n_skipped += 1;
+                        continue;
+                }
+
+                /* the time is not monotonic over the whole journal, entries
+                 * before the range are skipped and the first one after it ends
+                 * the query */
+                before_range = entry->realtime_usec < query->since_usec;
+                after_range = entry->realtime_usec >= query->until_usec;
+
+                if (query->backward ? before_range : after_range) {
+                        done = true;
+                        break;
+                }
+
+                if (before_range || after_range) {
+                        n_skipped += 1;
+                        continue;
+                }
+
+                if (n_entries == n_allocated) {
+                        n_allocated = MAX(n_allocated * 2, 16);
+                        entries = realloc(entries, n_allocated * sizeof(Entry *));
+                }
+
+                entries[n_entries] = entry;
+                entry = NULL;
+                n_entries += 1;
+        }
+
+        *cursorp = NULL;
+
+        /* stopped early, the journal is on the last entry looked at */
+        if (!done && (n_entries > 0 || n_skipped > 0)) {
+                r = sd_journal_get_cursor(reader->journal, cursorp);
+                if (r < 0) {
+                        entry_array_free(entries, n_entries);
+                        return r;
+                }
+        }
+
+        *entriesp = entries;
+        *n_entriesp = n_entries;
+
+        return 0;
+}
+
+/*
+ * Reads one page of the range of @query from the journal, in its direction.
+ * The cursor to continue with is returned in @cursorp if the range may hold
+ * more entries. A page ends early, maybe empty, after MAX_SKIPPED_ENTRIES
+ * entries that are not part of it.
+ */
+long reader_query(Reader *reader,
+                  const ReaderQuery *query,
+                  const EntryFields *fields,
+                  Entry ***entriesp,
+                  unsigned long *n_entriesp,
+                  char **cursorp) {
+        long r;
+
+        r = reader_read_query(reader, query, fields, entriesp, n_entriesp, cursorp);
+        if (r < 0)
+                return -VARLINK_ERROR_PANIC;
+
+        return 0;
+}
+
+/*
+ * Subscribes to new entries, starting with the @n_lines entries up to the
+ * reader's last entry. The first chunk is delivered right away, even
+ * if it is empty; the rest of the initial lines follows in later dispatches
+ * when they are not in the ring or exceed the subscription's limits.
+ */
+long reader_subscribe(Reader *reader,
+                      unsigned long n_lines,
+                      const ReaderOptions *options,
+                      ReaderEntriesCallback callback,
+                      void *userdata,
+                      ReaderSubscription **subscriptionp) {
+        ReaderSubscription *subscription;
+        Entry **entries = NULL;
+        unsigned long n_entries = 0;
+        _cleanup_(freep) char *cursor = NULL;
+        unsigned long skip = n_lines;
+        bool done = true;
+        long r;
+
+        subscription = calloc(1, sizeof(ReaderSubscription));
+        subscription->callback = callback;
+        subscription->userdata = userdata;
+        subscription->options = *options;
+        subscription->options.max_entries = MAX(options->max_entries, 1);
+        subscription->options.max_pending_entries = MAX(options->max_pending_entries, 1);
+        entry_fields_copy(&subscription->options.fields, &options->fields);
+
+        /* the initial lines end where the feed continues */
+        if (!reader->feed) {
+                r = reader_start_feed(reader);
+                if (r < 0) {
+                        entry_fields_clear(&subscription->options.fields);
+                        free(subscription);
+                        return -VARLINK_ERROR_PANIC;
+                }
+        }
+
+        entries = reader_ring_get(reader, n_lines, &options->fields);
+        if (entries) {
+                n_entries = n_lines;
+                if (reader->cursor)
+                        cursor = strdup(reader->cursor);
+
+        } else if (reader->cursor) {
+                r = reader_seek_cursor(reader, reader->cursor);
+                if (r >= 0)
+                        r = reader_seek_lines_back(reader, &skip);
+                if (r == -EAGAIN)
+                        /* the rest of the way back is for the dispatches */
+                        r = sd_journal_get_cursor(reader->journal, &cursor);
+                else if (r >= 0) {
+                        skip = 0;
+                        r = reader_read_entries(reader,
+                                                subscription_get_chunk_size(subscription),
+                                                true,
+                                                &options->fields,
+                                                &entries,
+                                                &n_entries,
+                                                &cursor);
+                }
+
+                if (r < 0) {
+                        entry_fields_clear(&subscription->options.fields);
+                        free(subscription);
+                        return -VARLINK_ERROR_PANIC;
+                }
+
+                done = r > 0;
+        }
+
+        subscription->next = reader->subscriptions;
+        if (reader->subscriptions)
+                reader->subscriptions->previous = subscription;
+        reader->subscriptions = subscription;
+
+        entry_fields_merge(&reader->fields, &subscription->options.fields);
+        feed_queue_set_fields(reader->feed, &reader->fields);
+
+        /* initial lines are never dropped */
+        if (n_entries > 0)
+                subscription_deliver_catch_up(subscription, entries, n_entries, cursor, done);
+        else {
+                if (!done)
+                        subscription_set_catching_up(subscription, cursor, skip);
+
+                subscription_deliver(subscription, NULL, 0, done ? reader->cursor : NULL);
+        }
+
+        entry_array_free(entries, n_entries);
+
+        *subscriptionp = subscription;
+
+        return 0;
+}
+
+void reader_unsubscribe(Reader *reader, ReaderSubscription *subscription) {
+        if (subscription->previous)
+                subscription->previous->next = subscription->next;
+        else
+                reader->subscriptions = subscription->next;
+
+        if (subscription->next)
+                subscription->next->previous = subscription->previous;
+
+        subscription_set_caught_up(subscription);
+        entry_array_free(subscription->held, subscription->n_held);
+        free(subscription->held_cursor);
+        entry_fields_clear(&subscription->options.fields);
+        free(subscription);
+
+        reader_update_fields(reader);
+}
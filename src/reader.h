@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "entry.h"
+#include "feed.h"
+#include "filter.h"
+
+/*
+ * A reader owns a journal of the service and belongs to the event loop of
+ * one thread. New entries are decoded once, by the feed of its filter in
+ * @feeds, and handed to all subscribed monitors in the event loop, one batch
+ * per dispatch so that a burst in the journal does not stall it. The last
+ * @ring_size entries are kept to answer the initial lines of new monitors.
+ * A reader with a @filter only reads the matching entries, and matches them
+ * itself if it shares the unfiltered feed. New entries are read with at
+ * least @fields, which is what the ring keeps. Readers without a ring start
+ * reading new entries with their first subscription.
+ */
+typedef struct Reader Reader;
+typedef struct ReaderSubscription ReaderSubscription;
+
+/*
+ * Options of a subscription. No delivery has more than @max_entries entries,
+ * and no more than @max_pending_entries and @max_pending_bytes are handed
+ * to a subscription until the client read them from @fd, the socket they
+ * are sent on. If new entries exceed that, they are dropped with @drop, or
+ * read again from the journal later. Without a socket, -1, the limits are
+ * renewed every 10 ms. Entries carry at least @fields, which are copied.
+ * New entries are held back for up to @max_delay_usec to fill a delivery,
+ * depending on the rate they come in; 0 delivers them right away.
+ */
+typedef struct {
+        unsigned long max_entries;
+        unsigned long max_pending_entries;
+        unsigned long max_pending_bytes;
+        int fd;
+        bool drop;
+        EntryFields fields;
+        uint64_t max_delay_usec;
+} ReaderOptions;
+
+/*
+ * A range of the journal, bounded by realtime timestamps from @since_usec
+ * up to, but not including, @until_usec, and by the entries of the
+ * @after and @before cursors, which are not part of it. It is read
+ * from the oldest entry, or from the newest one with @backward.
+ */
+typedef struct {
+        uint64_t since_usec;
+        uint64_t until_usec;
+        const char *after;
+        const char *before;
+        unsigned long limit;
+        bool backward;
+} ReaderQuery;
+
+/*
+ * @n_dropped counts the entries left out right before @entries. @cursor
+ * is the position after the last entry, if it is known for this delivery.
+ * Returns a negative errno-style value if the entries could not be sent,
+ * the subscription gets no more deliveries then.
+ */
+typedef long (*ReaderEntriesCallback)(Entry **entries,
+                                      unsigned long n_entries,
+                                      unsigned long n_dropped,
+                                      const char *cursor,
+                                      void *userdata);
+
+long reader_new(Reader **readerp,
+                FeedSet *feeds,
+                const Filter *filter,
+                const EntryFields *fields,
+                unsigned long ring_size);
+Reader *reader_free(Reader *reader);
+void reader_freep(Reader **readerp);
+
+int reader_get_fd(Reader *reader);
+const char *reader_get_cursor(Reader *reader);
+const Filter *reader_get_filter(Reader *reader);
+bool reader_has_subscriptions(Reader *reader);
+long reader_process(Reader *reader);
+long reader_dispatch(Reader *reader);
+uint64_t reader_get_deadline(Reader *reader);
+
+long reader_read_backlog(Reader *reader,
+                         unsigned long n_lines,
+                         const EntryFields *fields,
+                         Entry ***entriesp,
+                         unsigned long *n_entriesp);
+
+long reader_query(Reader *reader,
+                  const ReaderQuery *query,
+                  const EntryFields *fields,
+                  Entry ***entriesp,
+                  unsigned long *n_entriesp,
+                  char **cursorp);
+
+long reader_subscribe(Reader *reader,
+                      unsigned long n_lines,
+                      const ReaderOptions *options,
+                      ReaderEntriesCallback callback,
+                      void *userdata,
+                      ReaderSubscription **subscriptionp);
+void reader_unsubscribe(Reader *reader, ReaderSubscription *subscription);
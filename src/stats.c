@@ -0,0 +1,79 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "util.h"
+
+__thread Stats *stats_thread;
+
+/* the Stats of all counting threads, and what stopped threads counted */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static Stats *stats_list;
+static Stats stats_stopped;
+
+static void stats_add(Stats *sum, Stats *stats) {
+        sum->entries_read += __atomic_load_n(&stats->entries_read, __ATOMIC_RELAXED);
+        sum->bytes_read += __atomic_load_n(&stats->bytes_read, __ATOMIC_RELAXED);
+        sum->replies += __atomic_load_n(&stats->replies, __ATOMIC_RELAXED);
+        sum->entries_sent += __atomic_load_n(&stats->entries_sent, __ATOMIC_RELAXED);
+        sum->bytes_sent += __atomic_load_n(&stats->bytes_sent, __ATOMIC_RELAXED);
+        sum->failed_replies += __atomic_load_n(&stats->failed_replies, __ATOMIC_RELAXED);
+        sum->entries_dropped += __atomic_load_n(&stats->entries_dropped, __ATOMIC_RELAXED);
+        sum->iterations += __atomic_load_n(&stats->iterations, __ATOMIC_RELAXED);
+        sum->dispatches += __atomic_load_n(&stats->dispatches, __ATOMIC_RELAXED);
+        sum->dispatch_usec += __atomic_load_n(&stats->dispatch_usec, __ATOMIC_RELAXED);
+        sum->monitors += __atomic_load_n(&stats->monitors, __ATOMIC_RELAXED);
+        sum->lagging_monitors += __atomic_load_n(&stats->lagging_monitors, __ATOMIC_RELAXED);
+        sum->buffered_bytes += __atomic_load_n(&stats->buffered_bytes, __ATOMIC_RELAXED);
+        histogram_merge(&sum->journal_latency, &stats->journal_latency);
+        histogram_merge(&sum->service_latency, &stats->service_latency);
+        profile_merge(&sum->profile, &stats->profile);
+}
+
+void stats_thread_start(void) {
+        Stats *stats;
+
+        /* on a cache line of its own */
+        stats = aligned_alloc(64, ALIGN_TO(sizeof(Stats), 64));
+        memset(stats, 0, sizeof(Stats));
+
+        pthread_mutex_lock(&stats_lock);
+        stats->next = stats_list;
+        stats_list = stats;
+        pthread_mutex_unlock(&stats_lock);
+
+        stats_thread = stats;
+}
+
+void stats_thread_stop(void) {
+        Stats *stats = stats_thread;
+
+        if (!stats)
+                return;
+
+        stats_thread = NULL;
+
+        pthread_mutex_lock(&stats_lock);
+        for (Stats **s = &stats_list; *s; s = &(*s)->next) {
+                if (*s == stats) {
+                        *s = stats->next;
+                        break;
+                }
+        }
+
+        stats_add(&stats_stopped, stats);
+        pthread_mutex_unlock(&stats_lock);
+
+        free(stats);
+}
+
+void stats_sum(Stats *sum) {
+        memset(sum, 0, sizeof(Stats));
+
+        pthread_mutex_lock(&stats_lock);
+        stats_add(sum, &stats_stopped);
+        for (Stats *stats = stats_list; stats; stats = stats->next)
+                stats_add(sum, stats);
+        pthread_mutex_unlock(&stats_lock);
+}
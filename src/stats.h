@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "histogram.h"
+#include "profile.h"
+
+/*
+ * Counters of what the service does. Every thread counts into its own
+ * Stats, which only it writes, so that counting is a plain add without
+ * locks or contended cache lines. Counting in a thread that did not
+ * start its Stats does nothing.
+ *
+ * Gauges go up and down, possibly in different threads; only their sum
+ * over all threads means anything.
+ */
+typedef struct Stats {
+        /* entries read from the journal, and their estimated size */
+        uint64_t entries_read;
+        uint64_t bytes_read;
+
+        /* replies to monitors and queries */
+        uint64_t replies;
+        uint64_t entries_sent;
+        uint64_t bytes_sent;
+        uint64_t failed_replies;
+
+        /* entries left out for monitors that drop them */
+        uint64_t entries_dropped;
+
+        uint64_t iterations;
+        uint64_t dispatches;
+        uint64_t dispatch_usec;
+
+        /* gauges */
+        uint64_t monitors;
+        uint64_t lagging_monitors;
+        uint64_t buffered_bytes;
+
+        /* how long live entries took from the journal and from the feed */
+        Histogram journal_latency;
+        Histogram service_latency;
+
+        /* with --profile */
+        Profile profile;
+
+        struct Stats *next;
+} Stats;
+
+extern __thread Stats *stats_thread;
+
+/* Adds @n to @field of the current thread's Stats; @n may be negative. */
+#define STATS_ADD(_field, _n)                                                                   \
+        do {                                                                                    \
+                Stats *_stats = stats_thread;                                                   \
+                if (_stats)                                                                     \
+                        __atomic_store_n(&_stats->_field, _stats->_field + (uint64_t)(_n),      \
+                                         __ATOMIC_RELAXED);                                     \
+        } while (0)
+
+/* Counts @usec in @histogram of the current thread's Stats. */
+#define STATS_RECORD(_histogram, _usec)                                                         \
+        do {                                                                                    \
+                Stats *_stats = stats_thread;                                                   \
+                if (_stats)                                                                     \
+                        histogram_add(&_stats->_histogram, (_usec));                            \
+        } while (0)
+
+/* Counts a call of @phase, which started at @start from profile_begin(). */
+static inline void stats_profile(ProfilePhase phase, uint64_t start) {
+        Stats *stats = stats_thread;
+
+        if (profile_enabled && stats) {
+                uint64_t ticks = profile_ticks() - start;
+
+                __atomic_store_n(&stats->profile.calls[phase], stats->profile.calls[phase] + 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&stats->profile.ticks[phase], stats->profile.ticks[phase] + ticks, __ATOMIC_RELAXED);
+        }
+}
+
+/*
+ * Starts and stops counting in the calling thread. What a stopped thread
+ * counted stays in the sum.
+ */
+void stats_thread_start(void);
+void stats_thread_stop(void);
+
+/* Sums up the counters of all threads. */
+void stats_sum(Stats *sum);
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "timestamp.h"
+
+void time_format_init(TimeFormat *format, TimePrecision precision) {
+        format->precision = precision;
+        format->second = UINT64_MAX;
+        format->prefix_length = 0;
+}
+
+long time_precision_from_string(const char *string, TimePrecision *precisionp) {
+        if (strcmp(string, "s") == 0)
+                *precisionp = TIME_PRECISION_SECONDS;
+        else if (strcmp(string, "ms") == 0)
+                *precisionp = TIME_PRECISION_MILLISECONDS;
+        else if (strcmp(string, "us") == 0)
+                *precisionp = TIME_PRECISION_MICROSECONDS;
+        else
+                return -EINVAL;
+
+        return 0;
+}
+
+long format_time_rfc3339(TimeFormat *format, uint64_t usec, char *string, unsigned long max) {
+        uint64_t second = usec / 1000000;
+        unsigned long fraction = usec % 1000000;
+        unsigned long n_digits = 0;
+        char *p;
+
+        if (second != format->second) {
+                time_t time = second;
+                struct tm tm;
+
+                if (!gmtime_r(&time, &tm))
+                        return -EINVAL;
+
+                format->prefix_length = strftime(format->prefix, sizeof(format->prefix), "%Y-%m-%d %H:%M:%S", &tm);
+                if (format->prefix_length == 0)
+                        return -EINVAL;
+
+                format->second = second;
+        }
+
+        switch (format->precision) {
+                case TIME_PRECISION_SECONDS:
+                        break;
+
+                case TIME_PRECISION_MILLISECONDS:
+                        n_digits = 3;
+                        fraction /= 1000;
+                        break;
+
+                case TIME_PRECISION_MICROSECONDS:
+                        n_digits = 6;
+                        break;
+        }
+
+        /* prefix, '.', fraction, 'Z' and the terminating zero */
+        if (format->prefix_length + 1 + n_digits + 2 > max)
+                return -ENOBUFS;
+
+        memcpy(string, format->prefix, format->prefix_length);
+        p = string + format->prefix_length;
+
+        if (n_digits > 0) {
+                *p++ = '.';
+
+                for (unsigned long i = n_digits; i > 0; i -= 1) {
+                        p[i - 1] = '0' + fraction % 10;
+                        fraction /= 10;
+                }
+
+                p += n_digits;
+        }
+
+        *p++ = 'Z';
+        *p = '\0';
+
+        return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+        TIME_PRECISION_SECONDS,
+        TIME_PRECISION_MILLISECONDS,
+        TIME_PRECISION_MICROSECONDS
+} TimePrecision;
+
+/*
+ * Formats timestamps with the date and time of the last formatted second
+ * cached; entries of the same second only add their fraction.
+ */
+typedef struct {
+        TimePrecision precision;
+
+        uint64_t second;
+        char prefix[32];
+        unsigned long prefix_length;
+} TimeFormat;
+
+void time_format_init(TimeFormat *format, TimePrecision precision);
+long time_precision_from_string(const char *string, TimePrecision *precisionp);
+
+long format_time_rfc3339(TimeFormat *format, uint64_t usec, char *string, unsigned long max);
@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "utf8.h"
+
+long invalid_utf8_policy_from_string(const char *string, InvalidUtf8Policy *policyp) {
+        if (strcmp(string, "replace") == 0)
+                *policyp = INVALID_UTF8_REPLACE;
+        else if (strcmp(string, "hex") == 0)
+                *policyp = INVALID_UTF8_HEX;
+        else if (strcmp(string, "base64") == 0)
+                *policyp = INVALID_UTF8_BASE64;
+        else
+                return -EINVAL;
+
+        return 0;
+}
+
+/*
+ * Returns the length of the valid sequence at @p, or 0. Overlong forms,
+ * surrogates, code points above U+10FFFF and NUL bytes are invalid.
+ */
+static unsigned long utf8_sequence_length(const unsigned char *p, unsigned long length) {
+        unsigned long n;
+        unsigned char min = 0x80;
+        unsigned char max = 0xbf;
+
+        if (p[0] == 0)
+                return 0;
+
+        if (p[0] < 0x80)
+                return 1;
+
+        if (p[0] >= 0xc2 && p[0] <= 0xdf)
+                n = 2;
+        else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+                n = 3;
+                if (p[0] == 0xe0)
+                        min = 0xa0;
+                else if (p[0] == 0xed)
+                        max = 0x9f;
+        } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+                n = 4;
+                if (p[0] == 0xf0)
+                        min = 0x90;
+                else if (p[0] == 0xf4)
+                        max = 0x8f;
+        } else
+                return 0;
+
+        if (length < n)
+                return 0;
+
+        /* the second byte has the tighter range */
+        if (p[1] < min || p[1] > max)
+                return 0;
+
+        for (unsigned long i = 2; i < n; i += 1)
+                if (p[i] < 0x80 || p[i] > 0xbf)
+                        return 0;
+
+        return n;
+}
+
+/*
+ * Returns the length of the leading run of ASCII bytes other than NUL. Log
+ * messages are mostly that, and it is checked 16 bytes at a time.
+ */
+static unsigned long ascii_prefix_length(const unsigned char *p, unsigned long length) {
+        unsigned long i = 0;
+
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 16 <= length; i += 16) {
+                __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+
+                /* the high bit is set for non-ASCII bytes */
+                if (_mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, zero))) != 0)
+                        break;
+        }
+#endif
+
+        while (i < length && p[i] > 0 && p[i] < 0x80)
+                i += 1;
+
+        return i;
+}
+
+bool utf8_is_valid(const char *string, unsigned long length) {
+        const unsigned char *p = (const unsigned char *)string;
+        unsigned long i = 0;
+
+        while (i < length) {
+                unsigned long n;
+
+                i += ascii_prefix_length(p + i, length - i);
+                if (i == length)
+                        break;
+
+                n = utf8_sequence_length(p + i, length - i);
+                if (n == 0)
+                        return false;
+
+                i += n;
+        }
+
+        return true;
+}
+
+static char *base64_encode(const unsigned char *p, unsigned long length) {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        char *string;
+        char *s;
+        unsigned long i;
+
+        string = malloc((length + 2) / 3 * 4 + 1);
+        s = string;
+
+        for (i = 0; i + 3 <= length; i += 3) {
+                *s++ = table[p[i] >> 2];
+                *s++ = table[((p[i] & 0x03) << 4) | (p[i + 1] >> 4)];
+                *s++ = table[((p[i + 1] & 0x0f) << 2) | (p[i + 2] >> 6)];
+                *s++ = table[p[i + 2] & 0x3f];
+        }
+
+        if (length - i == 1) {
+                *s++ = table[p[i] >> 2];
+                *s++ = table[(p[i] & 0x03) << 4];
+                *s++ = '=';
+                *s++ = '=';
+        } else if (length - i == 2) {
+                *s++ = table[p[i] >> 2];
+                *s++ = table[((p[i] & 0x03) << 4) | (p[i + 1] >> 4)];
+                *s++ = table[(p[i + 1] & 0x0f) << 2];
+                *s++ = '=';
+        }
+
+        *s = '\0';
+
+        return string;
+}
+
+/*
+ * Returns a valid copy of @string according to @policy. Valid sequences
+ * are kept as they are, except with INVALID_UTF8_BASE64, and backslashes
+ * with INVALID_UTF8_HEX, which are doubled to tell them from escapes.
+ */
+char *utf8_make_valid(const char *string, unsigned long length, InvalidUtf8Policy policy) {
+        static const char hex[] = "0123456789abcdef";
+        const unsigned char *p = (const unsigned char *)string;
+        unsigned long i = 0;
+        char *valid;
+        char *s;
+
+        if (policy == INVALID_UTF8_BASE64)
+                return base64_encode(p, length);
+
+        /* an invalid byte takes at most four bytes */
+        valid = malloc(length * 4 + 1);
+        s = valid;
+
+        while (i < length) {
+                unsigned long n;
+
+                if (policy == INVALID_UTF8_HEX && p[i] == '\\') {
+                        *s++ = '\\';
+                        *s++ = '\\';
+                        i += 1;
+                        continue;
+                }
+
+                n = ascii_prefix_length(p + i, length - i);
+                if (policy == INVALID_UTF8_HEX) {
+                        const unsigned char *backslash = memchr(p + i, '\\', n);
+
+                        if (backslash)
+                                n = backslash - (p + i);
+                }
+
+                if (n == 0)
+                        n = utf8_sequence_length(p + i, length - i);
+
+                if (n > 0) {
+                        memcpy(s, p + i, n);
+                        s += n;
+                        i += n;
+                        continue;
+                }
+
+                if (policy == INVALID_UTF8_HEX) {
+                        *s++ = '\\';
+                        *s++ = 'x';
+                        *s++ = hex[p[i] >> 4];
+                        *s++ = hex[p[i] & 0x0f];
+                } else {
+                        /* U+FFFD REPLACEMENT CHARACTER */
+                        *s++ = (char)0xef;
+                        *s++ = (char)0xbf;
+                        *s++ = (char)0xbd;
+                }
+
+                i += 1;
+        }
+
+        *s = '\0';
+
+        return valid;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * What happens to strings that are not valid UTF-8, or contain NUL bytes,
+ * which cannot be passed on: invalid bytes are replaced with U+FFFD or
+ * written as "\xNN", or the whole string is base64 encoded. Backslashes
+ * are written as "\\" in every string with INVALID_UTF8_HEX.
+ */
+typedef enum {
+        INVALID_UTF8_REPLACE,
+        INVALID_UTF8_HEX,
+        INVALID_UTF8_BASE64
+} InvalidUtf8Policy;
+
+long invalid_utf8_policy_from_string(const char *string, InvalidUtf8Policy *policyp);
+
+bool utf8_is_valid(const char *string, unsigned long length);
+char *utf8_make_valid(const char *string, unsigned long length, InvalidUtf8Policy policy);
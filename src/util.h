@@ -1,9 +1,12 @@
 #pragma once
 
 #include <dirent.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #define _cleanup_(_x) __attribute__((__cleanup__(_x)))
@@ -28,6 +31,39 @@ static inline void closedirp(DIR **dirp) {
                 closedir(*dirp);
 }
 
+static inline long parse_unsigned(const char *string, unsigned long *numberp) {
+        char *end;
+        unsigned long number;
+
+        errno = 0;
+        number = strtoul(string, &end, 10);
+        if (errno != 0 || end == string || *end != '\0' || string[0] == '-')
+                return -EINVAL;
+
+        *numberp = number;
+
+        return 0;
+}
+
+static inline uint64_t now(clockid_t clock) {
+        struct timespec ts;
+
+        clock_gettime(clock, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Returns how much of @string fits into @max bytes without splitting a UTF-8 sequence. */
+static inline unsigned long utf8_truncate_length(const char *string, unsigned long length, unsigned long max) {
+        if (length <= max)
+                return length;
+
+        while (max > 0 && ((unsigned char)string[max] & 0xc0) == 0x80)
+                max -= 1;
+
+        return max;
+}
+
 #define MIN(_a, _b) ((_a) < (_b) ? (_a) : (_b))
 #define MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
 #define ARRAY_SIZE(_x) (sizeof(_x) / sizeof((_x)[0]))
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "view.h"
+#include "util.h"
+
+struct View {
+        unsigned long n_refs;
+        unsigned long id;
+
+        /* the list of views this view is part of */
+        View **views;
+        View *next;
+        View *previous;
+
+        ViewOptions options;
+        TimeFormat time_format;
+
+        /* The array of the last entries that were asked for. Monitors
+         * of the view that get the same batch share it. The references
+         * keep other entries from taking the place of these, and another
+         * thread from freeing the objects in the array with them. */
+        VarlinkArray *array;
+        Entry **array_entries;
+        unsigned long array_n_entries;
+};
+
+static const char *priorities[] = {
+        "debug",
+        "information",
+        "notice",
+        "warning",
+        "error",
+        "alert",
+        "critical",
+        "emergency"
+};
+
+static bool view_options_equal(const ViewOptions *a, const ViewOptions *b) {
+        if (!entry_fields_equal(&a->fields, &b->fields))
+                return false;
+
+        if (a->numeric_time != b->numeric_time)
+                return false;
+
+        /* the precision only matters for the formatted time */
+        if (!a->numeric_time && a->time_precision != b->time_precision)
+                return false;
+
+        if (a->invalid_utf8 != b->invalid_utf8)
+                return false;
+
+        return true;
+}
+
+/*
+ * Returns a reference to the view in @viewsp with @options, or adds a new
+ * one to it.
+ */
+long view_get(View **viewsp, const ViewOptions *options, View **viewp) {
+        static unsigned long next_id = 1;
+        View *view;
+
+        for (view = *viewsp; view; view = view->next) {
+                if (view_options_equal(&view->options, options)) {
+                        view->n_refs += 1;
+                        *viewp = view;
+                        return 0;
+                }
+        }
+
+        view = calloc(1, sizeof(View));
+        view->n_refs = 1;
+        view->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+        view->options = *options;
+        entry_fields_copy(&view->options.fields, &options->fields);
+        time_format_init(&view->time_format, options->time_precision);
+
+        view->views = viewsp;
+        view->next = *viewsp;
+        if (*viewsp)
+                (*viewsp)->previous = view;
+        *viewsp = view;
+
+        *viewp = view;
+
+        return 0;
+}
+
+static void view_clear_array(View *view) {
+        if (!view->array)
+                return;
+
+        varlink_array_unref(view->array);
+        entry_array_free(view->array_entries, view->array_n_entries);
+
+        view->array = NULL;
+        view->array_entries = NULL;
+        view->array_n_entries = 0;
+}
+
+View *view_unref(View *view) {
+        view->n_refs -= 1;
+
+        if (view->n_refs == 0) {
+                if (view->previous)
+                        view->previous->next = view->next;
+                else
+                        *view->views = view->next;
+
+                if (view->next)
+                        view->next->previous = view->previous;
+
+                view_clear_array(view);
+                entry_fields_clear(&view->options.fields);
+                free(view);
+        }
+
+        return NULL;
+}
+
+void view_unrefp(View **viewp) {
+        if (*viewp)
+                view_unref(*viewp);
+}
+
+/*
+ * Sets the @length bytes of @value as @name. Values that are not valid
+ * UTF-8 are made valid with the view's policy, and the names of the ones
+ * that were base64 encoded are added to @base64_fieldsp. With hex escapes,
+ * valid values with backslashes are escaped as well.
+ */
+static void view_set_string(View *view,
+                            Entry *entry,
+                            VarlinkObject *object,
+                            const char *name,
+                            const char *value,
+                            unsigned long length,
+                            VarlinkArray **base64_fieldsp) {
+        _cleanup_(freep) char *copy = NULL;
+        bool escape = view->options.invalid_utf8 == INVALID_UTF8_HEX && memchr(value, '\\', length);
+
+        if (!escape && (entry->valid_utf8 || utf8_is_valid(value, length))) {
+                /* values are NUL-terminated in the entry, unless they are cut here */
+                if (value[length] == '\0') {
+                        varlink_object_set_string(object, name, value);
+                        return;
+                }
+
+                copy = strndup(value, length);
+        } else {
+                copy = utf8_make_valid(value, length, view->options.invalid_utf8);
+
+                if (view->options.invalid_utf8 == INVALID_UTF8_BASE64) {
+                        if (!*base64_fieldsp)
+                                varlink_array_new(base64_fieldsp);
+
+                        varlink_array_append_string(*base64_fieldsp, name);
+                }
+        }
+
+        varlink_object_set_string(object, name, copy);
+}
+
+static VarlinkObject *view_build_entry_object(View *view, Entry *entry) {
+        _cleanup_(varlink_array_unrefp) VarlinkArray *base64_fields = NULL;
+        VarlinkObject *object;
+        long r;
+
+        varlink_object_new(&object);
+
+        if ((view->options.fields.mask & ENTRY_FIELD_CURSOR) && entry->cursor)
+                varlink_object_set_string(object, "cursor", entry->cursor);
+
+        if (view->options.numeric_time) {
+                char boot_id[33];
+
+                varlink_object_set_int(object, "time_usec", entry->realtime_usec);
+                varlink_object_set_int(object, "monotonic_usec", entry->monotonic_usec);
+                varlink_object_set_string(object, "boot_id", sd_id128_to_string(entry->boot_id, boot_id));
+        } else {
+                char time[40];
+                uint64_t start = profile_begin();
+
+                r = format_time_rfc3339(&view->time_format, entry->realtime_usec, time, sizeof(time));
+                stats_profile(PROFILE_FORMAT_TIME, start);
+                if (r == 0)
+                        varlink_object_set_string(object, "time", time);
+        }
+
+        if ((view->options.fields.mask & ENTRY_FIELD_MESSAGE) && entry->message) {
+                unsigned long max = view->options.fields.max_message_bytes;
+                unsigned long length = entry->message_length;
+
+                /* entries shared with other views may hold more */
+                if (max > 0 && length > max)
+                        length = utf8_truncate_length(entry->message, length, max);
+
+                view_set_string(view, entry, object, "message", entry->message, length, &base64_fields);
+
+                if (length < entry->message_original_length)
+                        varlink_object_set_int(object, "message_original_length", entry->message_original_length);
+        }
+
+        if ((view->options.fields.mask & ENTRY_FIELD_PRIORITY) && entry->priority >= 0)
+                varlink_object_set_string(object, "priority", priorities[entry->priority]);
+
+        if ((view->options.fields.mask & ENTRY_FIELD_PROCESS) && entry->process)
+                view_set_string(view, entry, object, "process", entry->process, entry->process_length, &base64_fields);
+
+        if ((view->options.fields.mask & ENTRY_FIELD_PID) && entry->pid >= 0)
+                varlink_object_set_int(object, "pid", entry->pid);
+
+        if ((view->options.fields.mask & ENTRY_FIELD_UID) && entry->uid >= 0)
+                varlink_object_set_int(object, "uid", entry->uid);
+
+        if (view->options.fields.n_extra > 0) {
+                _cleanup_(varlink_object_unrefp) VarlinkObject *fields = NULL;
+
+                varlink_object_new(&fields);
+
+                for (unsigned long i = 0; i < view->options.fields.n_extra; i += 1) {
+                        const char *name = view->options.fields.extra[i];
+                        unsigned long length;
+                        const char *value = entry_get_extra(entry, name, &length);
+
+                        if (value)
+                                view_set_string(view, entry, fields, name, value, length, &base64_fields);
+                }
+
+                varlink_object_set_object(object, "fields", fields);
+        }
+
+        if (base64_fields)
+                varlink_object_set_array(object, "base64_fields", base64_fields);
+
+        return object;
+}
+
+VarlinkObject *view_get_entry_object(View *view, Entry *entry) {
+        _cleanup_(varlink_object_unrefp) VarlinkObject *object = NULL;
+        VarlinkObject *cached;
+        uint64_t start;
+
+        cached = entry_get_object(entry, view->id);
+        if (cached)
+                return cached;
+
+        start = profile_begin();
+        object = view_build_entry_object(view, entry);
+        stats_profile(PROFILE_BUILD_OBJECT, start);
+        entry_set_object(entry, view->id, object);
+
+        return object;
+}
+
+/*
+ * Returns the array of the objects of @entries. The one of the last call is
+ * reused if it had the same entries, which is the case for all monitors of
+ * the view that receive the same batch. Readers that match the entries of
+ * a shared feed themselves may pass different ones between the same first
+ * and last entry, so all of them are compared.
+ */
+VarlinkArray *view_get_entries_array(View *view, Entry **entries, unsigned long n_entries) {
+        if (n_entries > 0 && view->array &&
+            view->array_n_entries == n_entries &&
+            memcmp(view->array_entries, entries, n_entries * sizeof(Entry *)) == 0)
+                return view->array;
+
+        view_clear_array(view);
+
+        varlink_array_new(&view->array);
+        for (unsigned long i = 0; i < n_entries; i += 1)
+                varlink_array_append_object(view->array, view_get_entry_object(view, entries[i]));
+
+        if (n_entries > 0) {
+                view->array_entries = calloc(n_entries, sizeof(Entry *));
+                for (unsigned long i = 0; i < n_entries; i += 1)
+                        view->array_entries[i] = entry_ref(entries[i]);
+
+                view->array_n_entries = n_entries;
+        }
+
+        return view->array;
+}
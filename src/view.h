@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "entry.h"
+#include "timestamp.h"
+#include "utf8.h"
+
+/*
+ * How entries are presented to a client. Monitors asking for the same
+ * presentation share a view, and every entry is turned into a varlink
+ * object once per view.
+ */
+typedef struct {
+        /* only these are serialized, extra fields go into a map */
+        EntryFields fields;
+
+        /* realtime and monotonic usec and boot id instead of the time */
+        bool numeric_time;
+        TimePrecision time_precision;
+
+        InvalidUtf8Policy invalid_utf8;
+} ViewOptions;
+
+typedef struct View View;
+
+long view_get(View **viewsp, const ViewOptions *options, View **viewp);
+View *view_unref(View *view);
+void view_unrefp(View **viewp);
+
+VarlinkObject *view_get_entry_object(View *view, Entry *entry);
+VarlinkArray *view_get_entries_array(View *view, Entry **entries, unsigned long n_entries);
@@ -0,0 +1,81 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "util.h"
+
+static const struct {
+        const char *term[4];
+        const char *other[4];
+        bool intersects;
+        const char *result[5];
+} intersections[] = {
+        { { "A=1" }, { "B=2" }, true, { "A=1", "B=2" } },
+        { { "A=1" }, { "A=1" }, true, { "A=1" } },
+        { { "A=1", "A=2" }, { "A=2", "A=3" }, true, { "A=2" } },
+        { { "A=1" }, { "A=2" }, false },
+        { { "A=1", "B=1" }, { "A=1", "B=2" }, false },
+        { {}, { "A=1" }, true, { "A=1" } },
+        { { "A=1" }, {}, true, { "A=1" } },
+        { { "A=1", "A=2", "B=1" }, { "A=1", "C=3" }, true, { "A=1", "B=1", "C=3" } },
+        { { "C=3" }, { "A=1", "B=1" }, true, { "A=1", "B=1", "C=3" } },
+
+        /* fields that are prefixes of others, and values with "=" */
+        { { "AB=1" }, { "A=1" }, true, { "A=1", "AB=1" } },
+        { { "A=1" }, { "AB=2" }, true, { "A=1", "AB=2" } },
+        { { "A=x=1" }, { "A=x=1", "A=x=2" }, true, { "A=x=1" } },
+        { { "A=x" }, { "A=x=1" }, false }
+};
+
+static void term_add_matches(FilterTerm *term, const char *const *matches) {
+        for (unsigned long i = 0; i < 4 && matches[i]; i += 1)
+                filter_term_add_match(term, matches[i]);
+}
+
+static bool term_equal(const FilterTerm *term, const char *const *matches) {
+        unsigned long n_matches = 0;
+
+        while (n_matches < 5 && matches[n_matches])
+                n_matches += 1;
+
+        if (term->n_matches != n_matches)
+                return false;
+
+        for (unsigned long i = 0; i < n_matches; i += 1)
+                if (strcmp(term->matches[i], matches[i]) != 0)
+                        return false;
+
+        return true;
+}
+
+static bool test_intersect(void) {
+        bool ok = true;
+
+        for (unsigned long i = 0; i < ARRAY_SIZE(intersections); i += 1) {
+                _cleanup_(filter_term_clear) FilterTerm term = {};
+                _cleanup_(filter_term_clear) FilterTerm other = {};
+
+                term_add_matches(&term, intersections[i].term);
+                term_add_matches(&other, intersections[i].other);
+
+                if (filter_term_intersect(&term, &other) != intersections[i].intersects) {
+                        fprintf(stderr, "filter_term_intersect: intersection %lu: expected %s\n",
+                                i, intersections[i].intersects ? "matches" : "none");
+                        ok = false;
+                        continue;
+                }
+
+                if (intersections[i].intersects && !term_equal(&term, intersections[i].result)) {
+                        fprintf(stderr, "filter_term_intersect: intersection %lu: unexpected matches\n", i);
+                        ok = false;
+                }
+        }
+
+        return ok;
+}
+
+int main(void) {
+        return test_intersect() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grep.h"
+#include "util.h"
+
+static const struct {
+        const char *patterns[5];
+        const char *text;
+        bool match;
+} searches[] = {
+        { { "a" }, "", false },
+        { { "a" }, "a", true },
+        { { "abc" }, "ab", false },
+        { { "abc" }, "xxabcxx", true },
+        { { "abc" }, "xxabxcx", false },
+        { { "aa" }, "a-a-a-a-a-a-a-a-a-a", false },
+        { { "0123456789abcdef" }, "0123456789abcdef", true },
+        { { "0123456789abcdefg" }, "0123456789abcdef", false },
+        { { "0123456789abcdefg" }, "-0123456789abcdefg-", true },
+
+        /* several patterns, which overlap */
+        { { "he", "she", "his", "hers" }, "ushers", true },
+        { { "he", "she", "his", "hers" }, "ushrs", false },
+        { { "abcd", "bc" }, "abc", true },
+        { { "abcd", "bce" }, "abce", true },
+        { { "abcd", "bce" }, "abcx", false },
+        { { "aab", "ab" }, "aaab", true },
+        { { "xyz", "yz" }, "xyy", false },
+        { { "abab", "babb" }, "ababb", true },
+        { { "abab", "babb" }, "abaab", false },
+        { { "a", "b" }, "ccccccccccccccccccccb", true },
+        { { "\xc3\xa9", "\xff" }, "caf\xc3\xa9", true },
+        { { "\xc3\xa9", "\xff" }, "caf\xc3", false }
+};
+
+static bool test_searches(void) {
+        bool ok = true;
+
+        for (unsigned long i = 0; i < ARRAY_SIZE(searches); i += 1) {
+                _cleanup_(grep_freep) Grep *grep = NULL;
+                unsigned long n_patterns = 0;
+
+                while (n_patterns < ARRAY_SIZE(searches[i].patterns) && searches[i].patterns[n_patterns])
+                        n_patterns += 1;
+
+                if (grep_new(&grep, (char **)searches[i].patterns, n_patterns) < 0) {
+                        fprintf(stderr, "grep_new: search %lu failed\n", i);
+                        ok = false;
+                        continue;
+                }
+
+                if (grep_match(grep, searches[i].text, strlen(searches[i].text)) != searches[i].match) {
+                        fprintf(stderr, "grep_match: search %lu: expected %s\n", i, searches[i].match ? "a match" : "none");
+                        ok = false;
+                }
+        }
+
+        return ok;
+}
+
+/*
+ * Puts patterns of lengths around the 16 bytes compared at once at every
+ * position of texts up to three strides long, once whole and once without
+ * their last byte.
+ */
+static bool test_positions(void) {
+        static const char pattern[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+        static const unsigned long lengths[] = { 1, 2, 3, 15, 16, 17, 31, 32, 33 };
+        char text[49];
+        bool ok = true;
+
+        for (unsigned long i = 0; i < ARRAY_SIZE(lengths); i += 1) {
+                for (unsigned long multiple = 0; multiple < 2; multiple += 1) {
+                        _cleanup_(grep_freep) Grep *grep = NULL;
+                        char *patterns[2];
+                        long r;
+
+                        /* the other pattern never matches */
+                        patterns[0] = strndup(pattern, lengths[i]);
+                        patterns[1] = strdup("!");
+
+                        r = grep_new(&grep, patterns, multiple ? 2 : 1);
+                        free(patterns[0]);
+                        free(patterns[1]);
+
+                        if (r < 0) {
+                                fprintf(stderr, "grep_new: pattern of length %lu failed\n", lengths[i]);
+                                ok = false;
+                                continue;
+                        }
+
+                        for (unsigned long length = 0; length < sizeof(text); length += 1) {
+                                for (unsigned long position = 0; position + lengths[i] <= length; position += 1) {
+                                        memset(text, '-', length);
+                                        memcpy(text + position, pattern, lengths[i]);
+
+                                        if (!grep_match(grep, text, length)) {
+                                                fprintf(stderr, "grep_match: %s pattern of length %lu at %lu of %lu not found\n",
+                                                        multiple ? "automaton" : "single", lengths[i], position, length);
+                                                ok = false;
+                                        }
+
+                                        /* only the last byte is missing */
+                                        text[position + lengths[i] - 1] = '-';
+
+                                        if (grep_match(grep, text, length)) {
+                                                fprintf(stderr, "grep_match: %s pattern of length %lu at %lu of %lu found without its last byte\n",
+                                                        multiple ? "automaton" : "single", lengths[i], position, length);
+                                                ok = false;
+                                        }
+                                }
+                        }
+                }
+        }
+
+        return ok;
+}
+
+static bool test_invalid(void) {
+        static const char *empty[] = { "a", "" };
+        _cleanup_(freep) char *long_pattern = NULL;
+        Grep *grep = NULL;
+        bool ok = true;
+
+        if (grep_new(&grep, (char **)empty, 0) != -EINVAL ||
+            grep_new(&grep, (char **)empty, 2) != -EINVAL) {
+                fprintf(stderr, "grep_new: accepted no or an empty pattern\n");
+                ok = false;
+        }
+
+        long_pattern = malloc(GREP_PATTERNS_MAX_LENGTH + 2);
+        memset(long_pattern, 'a', GREP_PATTERNS_MAX_LENGTH + 1);
+        long_pattern[GREP_PATTERNS_MAX_LENGTH + 1] = '\0';
+
+        if (grep_new(&grep, &long_pattern, 1) != -E2BIG) {
+                fprintf(stderr, "grep_new: accepted a pattern that is too long\n");
+                ok = false;
+        }
+
+        return ok;
+}
+
+int main(void) {
+        bool ok = true;
+
+        ok &= test_searches();
+        ok &= test_positions();
+        ok &= test_invalid();
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,163 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8.h"
+#include "util.h"
+
+static const struct {
+        const char *sequence;
+        unsigned long length;
+        bool valid;
+} sequences[] = {
+        { "a", 1, true },
+        { "\xc3\xa9", 2, true },
+        { "\xe2\x82\xac", 3, true },
+        { "\xed\x9f\xbf", 3, true },
+        { "\xee\x80\x80", 3, true },
+        { "\xf0\x9f\x98\x80", 4, true },
+        { "\xf4\x8f\xbf\xbf", 4, true },
+
+        /* NUL, stray continuation bytes and bytes that never occur */
+        { "\0", 1, false },
+        { "\x80", 1, false },
+        { "\xbf", 1, false },
+        { "\xfe", 1, false },
+        { "\xff", 1, false },
+
+        /* truncated */
+        { "\xc3", 1, false },
+        { "\xe2\x82", 2, false },
+        { "\xf0\x9f\x98", 3, false },
+        { "\xc3\x28", 2, false },
+        { "\xe2\x28\xac", 3, false },
+        { "\xf0\x9f\x28\x80", 4, false },
+
+        /* overlong */
+        { "\xc0\xaf", 2, false },
+        { "\xc1\xbf", 2, false },
+        { "\xe0\x80\xaf", 3, false },
+        { "\xe0\x9f\xbf", 3, false },
+        { "\xf0\x80\x80\xaf", 4, false },
+        { "\xf0\x8f\xbf\xbf", 4, false },
+
+        /* surrogates, and above U+10FFFF */
+        { "\xed\xa0\x80", 3, false },
+        { "\xed\xbf\xbf", 3, false },
+        { "\xf4\x90\x80\x80", 4, false },
+        { "\xf5\x80\x80\x80", 4, false }
+};
+
+static const struct {
+        const char *string;
+        unsigned long length;
+        InvalidUtf8Policy policy;
+        const char *valid;
+} conversions[] = {
+        { "abc", 3, INVALID_UTF8_REPLACE, "abc" },
+        { "a\xff" "b", 3, INVALID_UTF8_REPLACE, "a\xef\xbf\xbd" "b" },
+        { "\xe2\x82", 2, INVALID_UTF8_REPLACE, "\xef\xbf\xbd\xef\xbf\xbd" },
+        { "\xc3\xa9\0", 3, INVALID_UTF8_REPLACE, "\xc3\xa9\xef\xbf\xbd" },
+
+        { "a\xff" "b", 3, INVALID_UTF8_HEX, "a\\xff" "b" },
+        { "\xe2\x82", 2, INVALID_UTF8_HEX, "\\xe2\\x82" },
+        { "a\0b", 3, INVALID_UTF8_HEX, "a\\x00" "b" },
+        { "\\x41\xff", 5, INVALID_UTF8_HEX, "\\\\x41\\xff" },
+        { "\\\\", 2, INVALID_UTF8_HEX, "\\\\\\\\" },
+        { "\\\xc3\xa9", 3, INVALID_UTF8_HEX, "\\\\\xc3\xa9" },
+
+        { "", 0, INVALID_UTF8_BASE64, "" },
+        { "a", 1, INVALID_UTF8_BASE64, "YQ==" },
+        { "ab", 2, INVALID_UTF8_BASE64, "YWI=" },
+        { "abc", 3, INVALID_UTF8_BASE64, "YWJj" },
+        { "ab\0c", 4, INVALID_UTF8_BASE64, "YWIAYw==" },
+        { "\xff\xfe\xfd", 3, INVALID_UTF8_BASE64, "//79" }
+};
+
+/*
+ * Puts @sequence after @n_before and before @n_after bytes of ASCII, so
+ * that it is found at every offset of the 16 bytes checked at once.
+ */
+static char *make_string(const char *sequence, unsigned long length, unsigned long n_before, unsigned long n_after) {
+        char *string;
+
+        string = malloc(n_before + length + n_after + 1);
+        memset(string, 'x', n_before);
+        memcpy(string + n_before, sequence, length);
+        memset(string + n_before + length, 'y', n_after);
+        string[n_before + length + n_after] = '\0';
+
+        return string;
+}
+
+static bool test_is_valid(void) {
+        static const unsigned long n_after[] = { 0, 1, 15, 16, 17 };
+        bool ok = true;
+
+        for (unsigned long i = 0; i < ARRAY_SIZE(sequences); i += 1) {
+                for (unsigned long before = 0; before <= 33; before += 1) {
+                        for (unsigned long j = 0; j < ARRAY_SIZE(n_after); j += 1) {
+                                _cleanup_(freep) char *string = NULL;
+                                unsigned long length = before + sequences[i].length + n_after[j];
+
+                                string = make_string(sequences[i].sequence, sequences[i].length, before, n_after[j]);
+
+                                if (utf8_is_valid(string, length) != sequences[i].valid) {
+                                        fprintf(stderr, "utf8_is_valid: sequence %lu after %lu bytes, before %lu: expected %s\n",
+                                                i, before, n_after[j], sequences[i].valid ? "valid" : "invalid");
+                                        ok = false;
+                                }
+                        }
+                }
+        }
+
+        /* the length bounds the string, not the NUL */
+        if (!utf8_is_valid("abc\xff", 3) || utf8_is_valid("\xc3\xa9", 1)) {
+                fprintf(stderr, "utf8_is_valid: read past the length\n");
+                ok = false;
+        }
+
+        return ok;
+}
+
+static bool test_make_valid(void) {
+        bool ok = true;
+
+        for (unsigned long i = 0; i < ARRAY_SIZE(conversions); i += 1) {
+                _cleanup_(freep) char *valid = NULL;
+
+                valid = utf8_make_valid(conversions[i].string, conversions[i].length, conversions[i].policy);
+
+                if (strcmp(valid, conversions[i].valid) != 0) {
+                        fprintf(stderr, "utf8_make_valid: conversion %lu: expected \"%s\", got \"%s\"\n",
+                                i, conversions[i].valid, valid);
+                        ok = false;
+                }
+        }
+
+        /* the invalid byte follows runs of ASCII that are checked at once */
+        for (unsigned long before = 0; before <= 33; before += 1) {
+                _cleanup_(freep) char *string = make_string("\xff", 1, before, 0);
+                _cleanup_(freep) char *expected = make_string("\\xff", 4, before, 0);
+                _cleanup_(freep) char *valid = NULL;
+
+                valid = utf8_make_valid(string, before + 1, INVALID_UTF8_HEX);
+
+                if (strcmp(valid, expected) != 0) {
+                        fprintf(stderr, "utf8_make_valid: invalid byte after %lu bytes: got \"%s\"\n", before, valid);
+                        ok = false;
+                }
+        }
+
+        return ok;
+}
+
+int main(void) {
+        bool ok = true;
+
+        ok &= test_is_valid();
+        ok &= test_make_valid();
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}